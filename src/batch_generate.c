@@ -0,0 +1,444 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch_generate.h"
+#include "fingerprint_set.h"
+#include "stopwatch.h"
+#include <pthread.h>
+#include <string.h>
+
+int generation_table_build(GenerationTable *table, MarkovChain *markov_chain,
+                           hash_func hash) {
+    if (!table || !markov_chain || !markov_chain->database) {
+        return 1;
+    }
+    memset(table, 0, sizeof(*table));
+    size_t rows = (size_t)markov_chain->database->size;
+    size_t alloc_rows = rows ? rows : 1;
+    table->nodes = malloc(alloc_rows * sizeof(MarkovNode *));
+    table->starts = malloc(alloc_rows * sizeof(uint32_t));
+    table->terminal = malloc(alloc_rows);
+    table->totals = malloc(alloc_rows * sizeof(uint64_t));
+    if (!table->nodes || !table->starts || !table->terminal ||
+        !table->totals ||
+        (hash && node_index_init(&table->words, rows, hash,
+                                 markov_chain->comp_func) != 0)) {
+        generation_table_free(table);
+        return 1;
+    }
+    table->rows = rows;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        table->nodes[mnode->id] = mnode;
+        if (hash && node_index_insert(&table->words, mnode, mnode->id) != 0) {
+            generation_table_free(table);
+            return 1;
+        }
+    }
+    // In id order, like the database walk of get_first_random_node()
+    for (size_t row = 0; row < rows; row++) {
+        MarkovNode *mnode = table->nodes[row];
+        table->terminal[row] = markov_chain->is_last(mnode->data);
+        table->totals[row] = 0;
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            table->totals[row] += (uint64_t)mnode->frequency_list[i].frequency;
+        }
+        if (!table->terminal[row]) {
+            table->starts[table->num_starts++] = (uint32_t)row;
+        }
+    }
+    return 0;
+}
+
+void generation_table_free(GenerationTable *table) {
+    if (!table) {
+        return;
+    }
+    free(table->nodes);
+    free(table->starts);
+    free(table->terminal);
+    free(table->totals);
+    node_index_destroy(&table->words);
+    memset(table, 0, sizeof(*table));
+}
+
+long generation_table_lookup(const GenerationTable *table, const void *data) {
+    const NodeIndexSlot *slot = node_index_find(&table->words, data);
+    return slot ? (long)slot->value : -1;
+}
+
+/**
+ * Draw a successor of node like get_next_random_node_r(), from the same
+ * random number, but with the total of the list known in advance.
+ * @return the successor, or NULL if node has none
+ */
+static MarkovNode *next_node(const GenerationTable *table, MarkovNode *node,
+                             MarkovRng *rng) {
+    uint64_t total = table->totals[node->id];
+    if (total == 0) {
+        return NULL;
+    }
+    uint64_t random_num = markov_rng_below(rng, total);
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < node->freq_size; i++) {
+        cumulative += (uint64_t)node->frequency_list[i].frequency;
+        if (cumulative > random_num) {
+            return node->frequency_list[i].markov_node;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Walk from node until a terminal word, a word without successors or
+ * max_length words, writing ids to out.
+ * @return number of ids written
+ */
+static uint32_t walk(const GenerationTable *table, MarkovNode *node,
+                     MarkovRng *rng, int max_length, uint32_t *out) {
+    uint32_t length = 0;
+    for (;;) {
+        out[length++] = (uint32_t)node->id;
+        if (length == (uint32_t)max_length || table->terminal[node->id]) {
+            return length;
+        }
+        node = next_node(table, node, rng);
+        if (!node) {
+            return length;
+        }
+    }
+}
+
+/**
+ * Fill batch with sequences starting at the node with id start, or at
+ * random start words if start is negative.
+ */
+static size_t fill_batch(const GenerationTable *table, long start,
+                         MarkovRng *rng, size_t num_sequences,
+                         int max_length, SequenceBatch *batch) {
+    if (num_sequences > batch->max_sequences) {
+        num_sequences = batch->max_sequences;
+    }
+    size_t used = 0;
+    size_t count = 0;
+    while (count < num_sequences &&
+           batch->token_capacity - used >= (size_t)max_length) {
+        uint32_t row = start >= 0 ? (uint32_t)start : table->starts[
+            markov_rng_below(rng, table->num_starts)];
+        uint32_t length = walk(table, table->nodes[row], rng, max_length,
+                               batch->tokens + used);
+        batch->offsets[count] = used;
+        batch->lengths[count] = length;
+        used += length;
+        count++;
+    }
+    batch->count = count;
+    batch->used = used;
+    return count;
+}
+
+size_t generate_batch(const GenerationTable *table, MarkovRng *rng,
+                      size_t num_sequences, int max_length,
+                      SequenceBatch *batch) {
+    batch->count = 0;
+    batch->used = 0;
+    if (!table || table->num_starts == 0 || max_length < 1) {
+        return 0;
+    }
+    return fill_batch(table, -1, rng, num_sequences, max_length, batch);
+}
+
+/**
+ * Move the sequences of batch, written at offsets i * max_length, back to
+ * back.
+ */
+static void compact_batch(SequenceBatch *batch) {
+    size_t used = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        memmove(batch->tokens + used, batch->tokens + batch->offsets[i],
+                batch->lengths[i] * sizeof(uint32_t));
+        batch->offsets[i] = used;
+        used += batch->lengths[i];
+    }
+    batch->used = used;
+}
+
+/**
+ * State of one walk of generate_batch_interleaved().
+ */
+typedef struct WalkLane {
+    MarkovNode *node;   // prefetched, not read yet when list_pending is 0
+    size_t sequence;    // index of the walk in the batch
+    uint32_t length;
+    int list_pending;   // 1 once node was read and its list prefetched
+} WalkLane;
+
+/**
+ * Give lane the next sequence of the batch at a random start word.
+ * @return 0 if the batch is complete
+ */
+static int start_walk(const GenerationTable *table, MarkovRng *rng,
+                      size_t num_sequences, int max_length,
+                      SequenceBatch *batch, size_t *reserved, WalkLane *lane) {
+    if (batch->count == num_sequences ||
+        batch->token_capacity - *reserved < (size_t)max_length) {
+        return 0;
+    }
+    lane->sequence = batch->count++;
+    // Walks end out of order, so each gets max_length tokens for now
+    batch->offsets[lane->sequence] = *reserved;
+    *reserved += (size_t)max_length;
+    lane->node = table->nodes[table->starts[
+        markov_rng_below(rng, table->num_starts)]];
+    lane->length = 0;
+    lane->list_pending = 0;
+    __builtin_prefetch(lane->node);
+    return 1;
+}
+
+size_t generate_batch_interleaved(const GenerationTable *table,
+                                  MarkovRng *rng, size_t num_sequences,
+                                  int max_length, int lanes,
+                                  SequenceBatch *batch) {
+    batch->count = 0;
+    batch->used = 0;
+    if (!table || table->num_starts == 0 || max_length < 1 || lanes < 1) {
+        return 0;
+    }
+    if (lanes > MAX_WALK_LANES) {
+        lanes = MAX_WALK_LANES;
+    }
+    if (num_sequences > batch->max_sequences) {
+        num_sequences = batch->max_sequences;
+    }
+    WalkLane lane[MAX_WALK_LANES];
+    size_t reserved = 0;
+    int active = 0;
+    while (active < lanes && start_walk(table, rng, num_sequences, max_length,
+                                        batch, &reserved, &lane[active])) {
+        active++;
+    }
+
+    while (active > 0) {
+        for (int i = 0; i < active; i++) {
+            WalkLane *walk = &lane[i];
+            MarkovNode *node = walk->node;
+            if (walk->list_pending) {
+                // The list arrived while the other lanes were served
+                walk->node = next_node(table, node, rng);
+                walk->list_pending = 0;
+                if (walk->node) {
+                    __builtin_prefetch(walk->node);
+                    continue;
+                }
+            } else {
+                uint32_t *out = batch->tokens + batch->offsets[walk->sequence];
+                out[walk->length++] = (uint32_t)node->id;
+                if (walk->length < (uint32_t)max_length &&
+                    !table->terminal[node->id] && table->totals[node->id] > 0) {
+                    __builtin_prefetch(node->frequency_list);
+                    walk->list_pending = 1;
+                    continue;
+                }
+            }
+            // The walk ended: record it and reuse the lane
+            batch->lengths[walk->sequence] = walk->length;
+            if (!start_walk(table, rng, num_sequences, max_length, batch,
+                            &reserved, walk)) {
+                lane[i--] = lane[--active];
+            }
+        }
+    }
+
+    // Close the gaps left by walks shorter than max_length
+    compact_batch(batch);
+    return batch->count;
+}
+
+size_t generate_batch_from(const GenerationTable *table, const void *start,
+                           UnknownStartPolicy policy, MarkovRng *rng,
+                           size_t num_sequences, int max_length,
+                           SequenceBatch *batch) {
+    batch->count = 0;
+    batch->used = 0;
+    if (!table || max_length < 1) {
+        return 0;
+    }
+    long row = generation_table_lookup(table, start);
+    if (row < 0 &&
+        (policy != UNKNOWN_START_RANDOM || table->num_starts == 0)) {
+        return 0;
+    }
+    return fill_batch(table, row, rng, num_sequences, max_length, batch);
+}
+
+/**
+ * State shared by the threads of generate_batch_unique().
+ */
+typedef struct UniqueShared {
+    const GenerationTable *table;
+    long start;              // id of the start word, -1 for random ones
+    size_t num_sequences;
+    int max_length;
+    int max_retries;
+    SequenceBatch *batch;    // sequence i goes to tokens[i * max_length]
+    FingerprintSet seen;
+    size_t claimed;          // batch entries handed out
+    int stop;
+    int exhausted;
+    unsigned long long attempts;
+    unsigned long long duplicates;
+} UniqueShared;
+
+typedef struct UniqueWorker {
+    UniqueShared *shared;
+    uint64_t seed;
+    uint32_t *scratch;       // max_length tokens
+    pthread_t thread;
+    int running;
+} UniqueWorker;
+
+static void *unique_worker(void *arg) {
+    UniqueWorker *self = arg;
+    UniqueShared *shared = self->shared;
+    const GenerationTable *table = shared->table;
+    MarkovRng rng;
+    markov_rng_seed(&rng, self->seed);
+    unsigned long long attempts = 0, duplicates = 0;
+    int in_a_row = 0;
+    while (!__atomic_load_n(&shared->stop, __ATOMIC_ACQUIRE)) {
+        uint32_t row = shared->start >= 0 ? (uint32_t)shared->start
+            : table->starts[markov_rng_below(&rng, table->num_starts)];
+        uint32_t length = walk(table, table->nodes[row], &rng,
+                               shared->max_length, self->scratch);
+        attempts++;
+        int added = fingerprint_set_insert(
+            &shared->seen, fingerprint_tokens(self->scratch, length));
+        if (added == 0) {
+            duplicates++;
+            if (++in_a_row >= shared->max_retries) {
+                __atomic_store_n(&shared->exhausted, 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&shared->stop, 1, __ATOMIC_RELEASE);
+            }
+            continue;
+        }
+        in_a_row = 0;
+        size_t slot = added < 0 ? shared->num_sequences
+            : __atomic_fetch_add(&shared->claimed, 1, __ATOMIC_ACQ_REL);
+        if (slot + 1 >= shared->num_sequences) {
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELEASE);
+        }
+        if (slot >= shared->num_sequences) {
+            break; // Another thread filled the batch first
+        }
+        // Entries are disjoint, so no lock is needed to fill them
+        SequenceBatch *batch = shared->batch;
+        batch->offsets[slot] = slot * (size_t)shared->max_length;
+        batch->lengths[slot] = length;
+        memcpy(batch->tokens + batch->offsets[slot], self->scratch,
+               length * sizeof(uint32_t));
+    }
+    __atomic_fetch_add(&shared->attempts, attempts, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared->duplicates, duplicates, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+size_t generate_batch_unique(const GenerationTable *table, const void *start,
+                             UnknownStartPolicy policy, uint64_t seed,
+                             size_t num_sequences, int max_length,
+                             int max_retries, int num_threads,
+                             SequenceBatch *batch, UniqueStats *stats) {
+    double started = stopwatch_now();
+    batch->count = 0;
+    batch->used = 0;
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->requested = num_sequences;
+    }
+    if (!table || max_length < 1 || max_retries < 1 || num_threads < 1) {
+        return 0;
+    }
+    long row = start ? generation_table_lookup(table, start) : -1;
+    if ((row < 0 && start && policy != UNKNOWN_START_RANDOM) ||
+        (row < 0 && table->num_starts == 0)) {
+        return 0;
+    }
+    if (num_sequences > batch->max_sequences) {
+        num_sequences = batch->max_sequences;
+    }
+    if (num_sequences > batch->token_capacity / (size_t)max_length) {
+        num_sequences = batch->token_capacity / (size_t)max_length;
+    }
+    if (num_sequences == 0) {
+        return 0;
+    }
+
+    UniqueShared shared;
+    memset(&shared, 0, sizeof(shared));
+    shared.table = table;
+    shared.start = row;
+    shared.num_sequences = num_sequences;
+    shared.max_length = max_length;
+    shared.max_retries = max_retries;
+    shared.batch = batch;
+    UniqueWorker *workers = calloc((size_t)num_threads, sizeof(UniqueWorker));
+    // Threads that lose the race for the last entry insert one more each
+    if (!workers || fingerprint_set_init(&shared.seen, num_sequences +
+                                         (size_t)num_threads) != 0) {
+        free(workers);
+        return 0;
+    }
+    int failed = 0;
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].shared = &shared;
+        workers[t].seed = seed + (uint64_t)t;
+        workers[t].scratch = malloc((size_t)max_length * sizeof(uint32_t));
+        failed |= !workers[t].scratch;
+    }
+    // Worker 0 runs on the calling thread
+    for (int t = 1; !failed && t < num_threads; t++) {
+        workers[t].running = pthread_create(&workers[t].thread, NULL,
+                                            unique_worker, &workers[t]) == 0;
+    }
+    if (!failed) {
+        unique_worker(&workers[0]);
+    }
+    int threads = failed ? 0 : 1;
+    for (int t = 1; t < num_threads; t++) {
+        if (workers[t].running) {
+            pthread_join(workers[t].thread, NULL);
+            threads++;
+        }
+    }
+    for (int t = 0; t < num_threads; t++) {
+        free(workers[t].scratch);
+    }
+    free(workers);
+    fingerprint_set_destroy(&shared.seen);
+
+    batch->count = failed ? 0 : shared.claimed < num_sequences
+                                ? shared.claimed : num_sequences;
+    compact_batch(batch);
+    if (stats) {
+        stats->generated = batch->count;
+        stats->attempts = shared.attempts;
+        stats->duplicates = shared.duplicates;
+        stats->threads = threads;
+        stats->exhausted = shared.exhausted;
+        stats->seconds = stopwatch_now() - started;
+    }
+    return batch->count;
+}
+
+void render_sequence(const GenerationTable *table, MarkovChain *markov_chain,
+                     const uint32_t *tokens, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        markov_chain->print_func(table->nodes[tokens[i]]->data);
+    }
+    if (length > 0) {
+        // Generation only stops at a word that could go on when cut short
+        MarkovNode *last = table->nodes[tokens[length - 1]];
+        if (!table->terminal[last->id] && last->freq_size > 0) {
+            printf(" ->");
+        }
+    }
+    printf("\n");
+}
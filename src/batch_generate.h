@@ -0,0 +1,151 @@
+#ifndef _BATCH_GENERATE_H
+#define _BATCH_GENERATE_H
+
+#include "markov_chain.h"
+#include "node_index.h"
+#include <stdint.h>
+
+// Most walks generate_batch_interleaved() advances at once
+#define MAX_WALK_LANES 64
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * What generate_batch_from() does when the start word is not in the chain.
+ */
+typedef enum UnknownStartPolicy {
+    UNKNOWN_START_FAIL,    // generate nothing
+    UNKNOWN_START_RANDOM   // start every sequence at a random word instead
+} UnknownStartPolicy;
+
+/**
+ * Lookup tables for generating from a trained chain: the node of every id,
+ * the ids a sequence may start from and, optionally, a hash index from
+ * word to id. Random and given start words are both resolved in O(1)
+ * instead of walking the database. With the list totals kept here, drawing
+ * a successor stops at the chosen entry instead of summing the whole list
+ * first, which pays off once lists are sorted by descending frequency.
+ */
+typedef struct GenerationTable {
+    MarkovNode **nodes;  // rows entries, indexed by node id
+    size_t rows;
+    uint32_t *starts;    // ids of the non-terminal nodes
+    size_t num_starts;
+    unsigned char *terminal;  // 1 if the node ends a sequence
+    uint64_t *totals;         // sum of the frequency list of every node
+    NodeIndex words;          // data -> id, empty without a hash function
+} GenerationTable;
+
+/**
+ * Caller-owned output of generate_batch(). Sequences are stored back to
+ * back in tokens as node ids; sequence i is
+ * tokens[offsets[i] .. offsets[i] + lengths[i] - 1].
+ */
+typedef struct SequenceBatch {
+    uint32_t *tokens;
+    size_t token_capacity;
+    size_t *offsets;
+    uint32_t *lengths;
+    size_t max_sequences;  // entries of offsets and lengths
+    size_t count;          // sequences written by the last call
+    size_t used;           // tokens written by the last call
+} SequenceBatch;
+
+typedef struct UniqueStats {
+    size_t requested;
+    size_t generated;
+    unsigned long long attempts;    // sequences walked
+    unsigned long long duplicates;  // of them rejected
+    int threads;
+    int exhausted;  // 1 if a thread drew max_retries duplicates in a row
+    double seconds;
+} UniqueStats;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Build the tables of markov_chain. Node ids must be dense (see
+ * renumber_database()) and the chain must not change while the table is
+ * in use.
+ * @param hash hash function consistent with markov_chain->comp_func, or
+ *        NULL if start words will not be looked up
+ * @return 0 on success, 1 otherwise
+ */
+int generation_table_build(GenerationTable *table, MarkovChain *markov_chain,
+                           hash_func hash);
+
+void generation_table_free(GenerationTable *table);
+
+/**
+ * Generate up to num_sequences sequences into batch, each from a random
+ * start word until a terminal word, a word without successors or
+ * max_length words. Stops early when batch cannot hold another sequence of
+ * max_length words. Nothing is allocated.
+ * @return number of sequences written, also stored in batch->count
+ */
+size_t generate_batch(const GenerationTable *table, MarkovRng *rng,
+                      size_t num_sequences, int max_length,
+                      SequenceBatch *batch);
+
+/**
+ * Like generate_batch(), but up to lanes sequences are walked at once in
+ * round-robin. Each step of a walk is split in two: first the node is read
+ * and its frequency list prefetched, then, on the next turn of the lane, a
+ * successor is drawn and prefetched. While one walk waits for memory the
+ * others make progress, so on chains larger than the caches generation is
+ * bound by throughput instead of latency. Nothing is allocated.
+ * @param lanes number of concurrent walks, 1 .. MAX_WALK_LANES
+ * @return number of sequences written, also stored in batch->count
+ */
+size_t generate_batch_interleaved(const GenerationTable *table,
+                                  MarkovRng *rng, size_t num_sequences,
+                                  int max_length, int lanes,
+                                  SequenceBatch *batch);
+
+/**
+ * Look data up in the word index of table.
+ * @return the node id of data, or -1 if it is unknown or table has no index
+ */
+long generation_table_lookup(const GenerationTable *table, const void *data);
+
+/**
+ * Like generate_batch(), but every sequence starts at the word start (which
+ * may also be a terminal word). If start is unknown, policy decides.
+ * @return number of sequences written, also stored in batch->count
+ */
+size_t generate_batch_from(const GenerationTable *table, const void *start,
+                           UnknownStartPolicy policy, MarkovRng *rng,
+                           size_t num_sequences, int max_length,
+                           SequenceBatch *batch);
+
+/**
+ * Like generate_batch_from() (or generate_batch() if start is NULL), but
+ * every sequence written is distinct. Each walk is fingerprinted with a
+ * rolling hash over its token ids and kept only if the fingerprint is new
+ * to a lock-free FingerprintSet shared by num_threads threads, each with
+ * its own random stream seeded from seed. A thread gives up, and stops the
+ * others, after max_retries duplicates in a row: the chain then has few
+ * sequences left that were not generated yet. With one thread the output
+ * only depends on seed.
+ * @param stats receives the counts and the time taken, may be NULL
+ * @return number of sequences written, also stored in batch->count
+ */
+size_t generate_batch_unique(const GenerationTable *table, const void *start,
+                             UnknownStartPolicy policy, uint64_t seed,
+                             size_t num_sequences, int max_length,
+                             int max_retries, int num_threads,
+                             SequenceBatch *batch, UniqueStats *stats);
+
+/**
+ * Print a generated sequence with the chain's print_func, in the format of
+ * generate_random_sequence(): " ->" marks a sequence that was cut at its
+ * maximum length, and a newline ends it.
+ */
+void render_sequence(const GenerationTable *table, MarkovChain *markov_chain,
+                     const uint32_t *tokens, uint32_t length);
+
+#endif /* _BATCH_GENERATE_H */
@@ -0,0 +1,172 @@
+#include "beam_search.h"
+#include <math.h>
+#include <string.h>
+
+int beam_decoder_init(BeamDecoder *decoder, int beam_width, int max_length) {
+    if (!decoder || beam_width < 1 || max_length < 1) {
+        return 1;
+    }
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->beam_width = beam_width;
+    decoder->max_length = max_length;
+    size_t width = (size_t)beam_width;
+    decoder->steps = malloc((size_t)max_length * width * sizeof(BeamEntry));
+    decoder->step_sizes = malloc((size_t)max_length * sizeof(int));
+    decoder->candidates = malloc(width * sizeof(BeamEntry));
+    decoder->hits = malloc(width * sizeof(BeamEntry));
+    if (!decoder->steps || !decoder->step_sizes || !decoder->candidates ||
+        !decoder->hits) {
+        beam_decoder_free(decoder);
+        return 1;
+    }
+    return 0;
+}
+
+void beam_decoder_free(BeamDecoder *decoder) {
+    if (!decoder) {
+        return;
+    }
+    free(decoder->steps);
+    free(decoder->step_sizes);
+    free(decoder->candidates);
+    free(decoder->hits);
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+/**
+ * Offer entry to a min-heap holding at most capacity entries; once the heap
+ * is full, entry only gets in by replacing a worse one.
+ */
+static void push_bounded(BeamEntry *heap, int *size, int capacity,
+                         BeamEntry entry) {
+    int i;
+    if (*size < capacity) {
+        i = (*size)++;
+        while (i > 0 && heap[(i - 1) / 2].score > entry.score) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = entry;
+        return;
+    }
+    if (entry.score <= heap[0].score) {
+        return;
+    }
+    // Replace the worst entry and sift down
+    i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= *size) {
+            break;
+        }
+        if (child + 1 < *size && heap[child + 1].score < heap[child].score) {
+            child++;
+        }
+        if (heap[child].score >= entry.score) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = entry;
+}
+
+static int compare_entries_desc(const void *a, const void *b) {
+    double sa = ((const BeamEntry *)a)->score;
+    double sb = ((const BeamEntry *)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Expand entry into the candidate heap. Successors are sorted by
+ * descending frequency, so the first one that cannot enter a full heap ends
+ * the expansion.
+ */
+static void expand(BeamDecoder *decoder, const BeamEntry *entry, int slot,
+                   int *num_candidates) {
+    MarkovNode *node = entry->node;
+    long long total = 0;
+    for (size_t i = 0; i < node->freq_size; i++) {
+        total += node->frequency_list[i].frequency;
+    }
+    double log_total = log((double)total);
+    for (size_t i = 0; i < node->freq_size; i++) {
+        MarkovNodeFrequency *succ = &node->frequency_list[i];
+        double score = entry->score + log((double)succ->frequency) - log_total;
+        if (*num_candidates == decoder->beam_width &&
+            score <= decoder->candidates[0].score) {
+            break;
+        }
+        push_bounded(decoder->candidates, num_candidates, decoder->beam_width,
+                     (BeamEntry) {succ->markov_node, slot, score});
+    }
+}
+
+int beam_decode(BeamDecoder *decoder, MarkovChain *markov_chain,
+                MarkovNode *first_node) {
+    if (!decoder || !markov_chain || !first_node) {
+        return 0;
+    }
+    int width = decoder->beam_width;
+    decoder->num_hits = 0;
+    decoder->steps[0] = (BeamEntry) {first_node, -1, 0.0};
+    decoder->step_sizes[0] = 1;
+
+    for (int step = 0; step < decoder->max_length; step++) {
+        BeamEntry *beam = decoder->steps + (size_t)step * width;
+        int num_candidates = 0;
+        for (int slot = 0; slot < decoder->step_sizes[step]; slot++) {
+            BeamEntry *entry = &beam[slot];
+            // Scores only decrease, so a prefix worse than every kept
+            // finished sequence can be dropped
+            if (decoder->num_hits == width &&
+                entry->score <= decoder->hits[0].score) {
+                continue;
+            }
+            bool finished = markov_chain->is_last(entry->node->data) ||
+                            entry->node->freq_size == 0 ||
+                            step == decoder->max_length - 1;
+            if (finished) {
+                BeamEntry hit = {entry->node, step * width + slot,
+                                 entry->score};
+                push_bounded(decoder->hits, &decoder->num_hits, width, hit);
+            } else {
+                expand(decoder, entry, slot, &num_candidates);
+            }
+        }
+        if (num_candidates == 0) {
+            break;
+        }
+        // Candidates become the next step, best first
+        BeamEntry *next = beam + width;
+        memcpy(next, decoder->candidates,
+               (size_t)num_candidates * sizeof(BeamEntry));
+        qsort(next, (size_t)num_candidates, sizeof(BeamEntry),
+              compare_entries_desc);
+        decoder->step_sizes[step + 1] = num_candidates;
+    }
+
+    qsort(decoder->hits, (size_t)decoder->num_hits, sizeof(BeamEntry),
+          compare_entries_desc);
+    return decoder->num_hits;
+}
+
+int beam_decoder_result(BeamDecoder *decoder, int rank, MarkovNode **path,
+                        double *log_prob) {
+    if (!decoder || !path || rank < 0 || rank >= decoder->num_hits) {
+        return 0;
+    }
+    const BeamEntry *hit = &decoder->hits[rank];
+    int last_step = hit->parent / decoder->beam_width;
+    int slot = hit->parent % decoder->beam_width;
+    for (int step = last_step; step >= 0; step--) {
+        const BeamEntry *entry =
+            &decoder->steps[(size_t)step * decoder->beam_width + slot];
+        path[step] = entry->node;
+        slot = entry->parent;
+    }
+    if (log_prob) {
+        *log_prob = hit->score;
+    }
+    return last_step + 1;
+}
@@ -0,0 +1,72 @@
+#ifndef _BEAM_SEARCH_H
+#define _BEAM_SEARCH_H
+
+#include "markov_chain.h"
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * One hypothesis: the node it ends in and a back-pointer to its prefix.
+ * In a step, parent is the slot of the prefix in the previous step (-1 for
+ * the start node); for a finished sequence it is its position in steps.
+ */
+typedef struct BeamEntry {
+    MarkovNode *node;
+    int parent;
+    double score;  // log-probability of the whole prefix
+} BeamEntry;
+
+/**
+ * Beam-search decoder over a chain. All storage is allocated once by
+ * beam_decoder_init(), so beam_decode() does no allocation per expansion:
+ * hypotheses live in a max_length x beam_width table of back-pointers and
+ * candidates compete in bounded min-heaps.
+ *
+ * The chain's frequency lists must be sorted by sort_frequency_lists()
+ * first; expansion of a node stops at the first successor that cannot
+ * enter the beam.
+ */
+typedef struct BeamDecoder {
+    int beam_width;
+    int max_length;   // words per sequence, including the start word
+    BeamEntry *steps; // max_length rows of beam_width entries
+    int *step_sizes;  // live entries of every step
+    BeamEntry *candidates; // min-heap for the next step
+    BeamEntry *hits;       // min-heap of the best finished sequences
+    int num_hits;
+} BeamDecoder;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Allocate a decoder keeping beam_width hypotheses of up to max_length words.
+ * @return 0 on success, 1 otherwise
+ */
+int beam_decoder_init(BeamDecoder *decoder, int beam_width, int max_length);
+
+void beam_decoder_free(BeamDecoder *decoder);
+
+/**
+ * Find the beam_width most probable sequences starting at first_node. A
+ * sequence ends at a terminal node, at a node without successors or after
+ * max_length words.
+ * @return number of sequences found, ranked by beam_decoder_result()
+ */
+int beam_decode(BeamDecoder *decoder, MarkovChain *markov_chain,
+                MarkovNode *first_node);
+
+/**
+ * Copy the sequence of the given rank (0 is the most probable) found by the
+ * last beam_decode() call.
+ * @param path receives up to max_length nodes
+ * @param log_prob receives the log-probability of the sequence, may be NULL
+ * @return the sequence length, or 0 if rank is out of range
+ */
+int beam_decoder_result(BeamDecoder *decoder, int rank, MarkovNode **path,
+                        double *log_prob);
+
+#endif /* _BEAM_SEARCH_H */
@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
+#include "byte_chain.h"
+#include "stopwatch.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIN_ROWS 256
+// Cumulative counts stay below 2^31 so they compare as signed 32-bit lanes
+#define BYTE_CHAIN_MAX_TOTAL (1u << 30)
+
+int byte_chain_init(ByteChain *chain, int order) {
+    if (!chain || order < 1 || order > BYTE_CHAIN_MAX_ORDER) {
+        return EXIT_FAILURE;
+    }
+    memset(chain, 0, sizeof(*chain));
+    chain->order = order;
+    chain->context_mask = (uint32_t)((1ull << (8 * order)) - 1);
+    for (int i = 0; i < order; i++) {
+        chain->start_context = (chain->start_context << 8) |
+                               BYTE_CHAIN_DELIMITER;
+    }
+    chain->context = chain->start_context;
+    // Zero pages of the contexts never seen are never touched
+    chain->row_of = calloc((size_t)chain->context_mask + 1, sizeof(uint32_t));
+    if (!chain->row_of) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void byte_chain_destroy(ByteChain *chain) {
+    if (!chain) {
+        return;
+    }
+    free(chain->row_of);
+    free(chain->counts);
+    free(chain->totals);
+    free(chain->sampling);
+    memset(chain, 0, sizeof(*chain));
+}
+
+/**
+ * Give context a row of zero counts.
+ * @return the row id + 1, or 0 on allocation failure
+ */
+static uint32_t add_row(ByteChain *chain, uint32_t context) {
+    if (chain->rows == chain->capacity) {
+        size_t capacity = chain->capacity ? chain->capacity * 2 : MIN_ROWS;
+        uint32_t *counts = realloc(chain->counts, capacity * BYTE_ALPHABET *
+                                                  sizeof(uint32_t));
+        if (!counts) {
+            return 0;
+        }
+        chain->counts = counts;
+        uint32_t *totals = realloc(chain->totals, capacity * sizeof(uint32_t));
+        if (!totals) {
+            return 0;
+        }
+        chain->totals = totals;
+        chain->capacity = capacity;
+    }
+    memset(chain->counts + chain->rows * BYTE_ALPHABET, 0,
+           BYTE_ALPHABET * sizeof(uint32_t));
+    chain->totals[chain->rows] = 0;
+    chain->rows++;
+    chain->row_of[context] = (uint32_t)chain->rows;
+    return (uint32_t)chain->rows;
+}
+
+/**
+ * Halve the counts of a row about to overflow, keeping every seen byte.
+ */
+static void halve_row(ByteChain *chain, uint32_t row) {
+    uint32_t *counts = chain->counts + (size_t)row * BYTE_ALPHABET;
+    uint32_t total = 0;
+    for (int i = 0; i < BYTE_ALPHABET; i++) {
+        counts[i] = (counts[i] + 1) / 2;
+        total += counts[i];
+    }
+    chain->totals[row] = total;
+    chain->stats.halvings++;
+}
+
+int byte_chain_train(ByteChain *chain, const unsigned char *text,
+                     size_t length) {
+    if (!chain || !chain->row_of || (!text && length > 0)) {
+        return EXIT_FAILURE;
+    }
+    double start = stopwatch_now();
+    const uint32_t *row_of = chain->row_of;
+    uint32_t *counts = chain->counts;
+    uint32_t *totals = chain->totals;
+    uint32_t context = chain->context;
+    int result = EXIT_SUCCESS;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        unsigned char byte = text[i];
+        uint32_t row = row_of[context];
+        if (row == 0) {
+            row = add_row(chain, context);
+            if (row == 0) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            counts = chain->counts;
+            totals = chain->totals;
+        }
+        row--;
+        counts[(size_t)row * BYTE_ALPHABET + byte]++;
+        if (++totals[row] == BYTE_CHAIN_MAX_TOTAL) {
+            halve_row(chain, row);
+        }
+        context = byte == BYTE_CHAIN_DELIMITER
+                  ? chain->start_context
+                  : ((context << 8) | byte) & chain->context_mask;
+    }
+    chain->context = context;
+    chain->stats.bytes_trained += i;
+    chain->stats.rows = chain->rows;
+    chain->stats.train_seconds += stopwatch_now() - start;
+    return result;
+}
+
+int byte_chain_finalize(ByteChain *chain) {
+    if (!chain || !chain->row_of ||
+        chain->row_of[chain->start_context] == 0) {
+        return EXIT_FAILURE;
+    }
+    double start = stopwatch_now();
+    ByteRow *sampling = realloc(chain->sampling,
+                                chain->rows * sizeof(ByteRow));
+    if (!sampling) {
+        return EXIT_FAILURE;
+    }
+    chain->sampling = sampling;
+    for (size_t r = 0; r < chain->rows; r++) {
+        const uint32_t *counts = chain->counts + r * BYTE_ALPHABET;
+        ByteRow *row = &sampling[r];
+        uint32_t sum = 0;
+        for (int i = 0; i < BYTE_ALPHABET; i++) {
+            sum += counts[i];
+            row->cumulative[i] = sum;
+        }
+        for (int j = 0; j < BYTE_BLOCKS; j++) {
+            row->blocks[j] = row->cumulative[16 * j + 15];
+        }
+    }
+    chain->sampling_rows = chain->rows;
+    chain->stats.model_bytes =
+        ((size_t)chain->context_mask + 1) * sizeof(uint32_t) +
+        chain->capacity * (BYTE_ALPHABET + 1) * sizeof(uint32_t) +
+        chain->rows * sizeof(ByteRow);
+    chain->stats.finalize_seconds += stopwatch_now() - start;
+    return EXIT_SUCCESS;
+}
+
+#ifdef __SSE2__
+/**
+ * Count the 16 values that are below bound (r + 1 in every lane) without
+ * branches. Cumulative counts never decrease, so the lanes that compare
+ * below form a prefix of the movemask.
+ */
+static inline uint32_t count_below(const uint32_t *values, __m128i bound) {
+    const __m128i *v = (const __m128i *)values;
+    __m128i low = _mm_packs_epi32(_mm_cmpgt_epi32(bound, _mm_loadu_si128(v)),
+                                  _mm_cmpgt_epi32(bound,
+                                                  _mm_loadu_si128(v + 1)));
+    __m128i high = _mm_packs_epi32(_mm_cmpgt_epi32(bound,
+                                                   _mm_loadu_si128(v + 2)),
+                                   _mm_cmpgt_epi32(bound,
+                                                   _mm_loadu_si128(v + 3)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(low, high));
+    return (uint32_t)__builtin_ctz(~mask);
+}
+#endif
+
+/**
+ * Return the byte drawn by r in [0, total): the first byte whose cumulative
+ * count exceeds r, i.e. the number of cumulative counts that do not.
+ */
+static inline uint32_t search_row(const ByteRow *row, uint32_t r) {
+#ifdef __SSE2__
+    __m128i bound = _mm_set1_epi32((int)(r + 1));
+    uint32_t block = count_below(row->blocks, bound);
+    return block * 16 + count_below(row->cumulative + block * 16, bound);
+#else
+    uint32_t block = 0;
+    for (int j = 0; j < BYTE_BLOCKS; j++) {
+        block += row->blocks[j] <= r;
+    }
+    const uint32_t *cumulative = row->cumulative + block * 16;
+    uint32_t byte = block * 16;
+    for (int i = 0; i < 16; i++) {
+        byte += cumulative[i] <= r;
+    }
+    return byte;
+#endif
+}
+
+/**
+ * Draw the byte that follows *context and move the context past it. A
+ * context that was never followed by anything starts a new line instead.
+ */
+static inline unsigned char next_byte(const ByteChain *chain, MarkovRng *rng,
+                                      uint32_t *context) {
+    uint32_t row = chain->row_of[*context];
+    if (row == 0 || row > chain->sampling_rows) {
+        row = chain->row_of[chain->start_context];
+    }
+    const ByteRow *sampling = &chain->sampling[row - 1];
+    // The last block ends at the total, in the cache line searched first
+    uint32_t r = (uint32_t)markov_rng_below(
+        rng, sampling->blocks[BYTE_BLOCKS - 1]);
+    unsigned char byte = (unsigned char)search_row(sampling, r);
+    *context = byte == BYTE_CHAIN_DELIMITER
+               ? chain->start_context
+               : ((*context << 8) | byte) & chain->context_mask;
+    return byte;
+}
+
+size_t byte_chain_generate(const ByteChain *chain, MarkovRng *rng,
+                           uint32_t *context, unsigned char *out,
+                           size_t length, bool stop_at_delimiter) {
+    if (!chain || !chain->sampling || !rng || !context || !out) {
+        return 0;
+    }
+    *context &= chain->context_mask;
+    size_t written = 0;
+    while (written < length) {
+        unsigned char byte = next_byte(chain, rng, context);
+        out[written++] = byte;
+        if (stop_at_delimiter && byte == BYTE_CHAIN_DELIMITER) {
+            break;
+        }
+    }
+    return written;
+}
+
+size_t byte_chain_generate_lanes(const ByteChain *chain, MarkovRng *rngs,
+                                 uint32_t *contexts, int lanes,
+                                 unsigned char *out, size_t length) {
+    if (!chain || !chain->sampling || !rngs || !contexts || !out ||
+        lanes < 1) {
+        return 0;
+    }
+    size_t segment = length / (size_t)lanes;
+    for (int l = 0; l < lanes; l++) {
+        contexts[l] &= chain->context_mask;
+    }
+    for (size_t i = 0; i < segment; i++) {
+        for (int l = 0; l < lanes; l++) {
+            out[l * segment + i] = next_byte(chain, &rngs[l], &contexts[l]);
+        }
+    }
+    return segment * (size_t)lanes;
+}
+
+void print_byte_chain_stats(FILE *out, const ByteChainStats *stats,
+                            double generated_bytes, double generate_seconds) {
+    if (!out || !stats) {
+        return;
+    }
+    double trained_mb = stats->bytes_trained / 1048576.0;
+    double generated_mb = generated_bytes / 1048576.0;
+    fprintf(out, "Byte chain: %zu contexts, %.1f MB, %zu rows halved\n",
+            stats->rows, stats->model_bytes / 1048576.0, stats->halvings);
+    fprintf(out, "  trained %.2f MB in %.3f s (%.1f MB/s), finalized in "
+            "%.3f s\n", trained_mb, stats->train_seconds,
+            stats->train_seconds > 0 ? trained_mb / stats->train_seconds : 0.0,
+            stats->finalize_seconds);
+    fprintf(out, "  generated %.2f MB in %.3f s (%.1f MB/s)\n", generated_mb,
+            generate_seconds,
+            generate_seconds > 0 ? generated_mb / generate_seconds : 0.0);
+}
@@ -0,0 +1,122 @@
+#ifndef _BYTE_CHAIN_H
+#define _BYTE_CHAIN_H
+
+#include "markov_chain.h"
+#include <stdint.h>
+
+// Longest context: rows are indexed directly by 256^order contexts
+#define BYTE_CHAIN_MAX_ORDER 3
+// Byte that ends a sequence; the context starts over after it
+#define BYTE_CHAIN_DELIMITER '\n'
+#define BYTE_ALPHABET 256
+#define BYTE_BLOCKS (BYTE_ALPHABET / 16)
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Successor distribution of one context, ready for sampling. cumulative[i]
+ * is the count of bytes 0 .. i, and blocks[j] is cumulative[16 * j + 15],
+ * so a draw finds its block of 16 bytes in one cache line and then its
+ * byte in one more.
+ */
+typedef struct ByteRow {
+    uint32_t blocks[BYTE_BLOCKS];
+    uint32_t cumulative[BYTE_ALPHABET];
+} ByteRow;
+
+typedef struct ByteChainStats {
+    unsigned long long bytes_trained;
+    size_t rows;           // contexts seen
+    size_t model_bytes;    // counts, sampling rows and context index
+    size_t halvings;       // rows whose counts were halved to fit
+    double train_seconds;
+    double finalize_seconds;
+} ByteChainStats;
+
+/**
+ * Order-k Markov chain over bytes. The word chain stores a node, a payload
+ * and a pointer list per state, which costs far more than the state itself
+ * when the alphabet has 256 symbols. Here the last order bytes, read as a
+ * number, index a table of row ids, and every row is a dense array of 256
+ * counts, so training one byte is an increment at a computed address.
+ * byte_chain_finalize() turns the counts into cumulative rows searched with
+ * SIMD compares.
+ *
+ * Each line of the text is a sequence: after BYTE_CHAIN_DELIMITER the
+ * context is reset to order delimiters, both in training and in generation.
+ */
+typedef struct ByteChain {
+    int order;
+    uint32_t context_mask;   // 256^order - 1
+    uint32_t start_context;  // context at the start of a line
+    uint32_t context;        // context after the text trained so far
+    uint32_t *row_of;        // context -> row id + 1, 0 if never seen
+    uint32_t *counts;        // rows * 256 successor counts
+    uint32_t *totals;        // sum of every row of counts
+    size_t rows;
+    size_t capacity;         // rows counts can hold
+    ByteRow *sampling;       // cumulative rows, NULL until finalized
+    size_t sampling_rows;    // rows finalized, later ones cannot be drawn
+    ByteChainStats stats;
+} ByteChain;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Start an empty chain whose contexts are the last order bytes.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on a bad order or
+ *         allocation failure
+ */
+int byte_chain_init(ByteChain *chain, int order);
+
+void byte_chain_destroy(ByteChain *chain);
+
+/**
+ * Count every byte of text after the context it follows. Calls may split
+ * the text anywhere: the context carries over.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on allocation failure
+ */
+int byte_chain_train(ByteChain *chain, const unsigned char *text,
+                     size_t length);
+
+/**
+ * Build the cumulative rows used by byte_chain_generate(). Training may go
+ * on afterwards, followed by another call.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on allocation failure or if
+ *         no line start was trained
+ */
+int byte_chain_finalize(ByteChain *chain);
+
+/**
+ * Draw up to length bytes into out, starting from *context (use
+ * chain->start_context for a new line) and storing the context reached
+ * back into it. A context that was never followed by anything starts a new
+ * line instead.
+ * @param stop_at_delimiter end after writing BYTE_CHAIN_DELIMITER
+ * @return number of bytes written
+ */
+size_t byte_chain_generate(const ByteChain *chain, MarkovRng *rng,
+                           uint32_t *context, unsigned char *out,
+                           size_t length, bool stop_at_delimiter);
+
+/**
+ * Like byte_chain_generate() without stopping, but lanes independent walks
+ * are advanced in turn, lane l writing the l-th of lanes equal segments of
+ * out with its own random stream rngs[l] from contexts[l]. Every byte of
+ * a walk depends on the one before, so a single walk is bound by latency;
+ * independent lanes overlap their loads.
+ * @return number of bytes written, length rounded down to a multiple of
+ *         lanes
+ */
+size_t byte_chain_generate_lanes(const ByteChain *chain, MarkovRng *rngs,
+                                 uint32_t *contexts, int lanes,
+                                 unsigned char *out, size_t length);
+
+void print_byte_chain_stats(FILE *out, const ByteChainStats *stats,
+                            double generated_bytes, double generate_seconds);
+
+#endif /* _BYTE_CHAIN_H */
@@ -0,0 +1,407 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_analysis.h"
+#include "stopwatch.h"
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+// Per-thread partial sums are spaced a cache line apart
+#define PARTIAL_STRIDE 8
+
+void transition_matrix_free(TransitionMatrix *matrix) {
+    if (!matrix) {
+        return;
+    }
+    free(matrix->out_start);
+    free(matrix->out_cols);
+    free(matrix->out_probs);
+    free(matrix->in_start);
+    free(matrix->in_rows);
+    free(matrix->in_probs);
+    free(matrix->terminal);
+    free(matrix->dangling);
+    free(matrix->restart);
+    memset(matrix, 0, sizeof(*matrix));
+}
+
+int transition_matrix_build(TransitionMatrix *matrix,
+                            MarkovChain *markov_chain) {
+    if (!matrix || !markov_chain || !markov_chain->database) {
+        return 1;
+    }
+    memset(matrix, 0, sizeof(*matrix));
+    size_t rows = (size_t)markov_chain->database->size;
+    size_t edges = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        if (!markov_chain->is_last(mnode->data)) {
+            edges += mnode->freq_size;
+        }
+    }
+    matrix->rows = rows;
+    matrix->edges = edges;
+    size_t alloc_edges = edges ? edges : 1;
+    matrix->out_start = calloc(rows + 1, sizeof(size_t));
+    matrix->out_cols = malloc(alloc_edges * sizeof(uint32_t));
+    matrix->out_probs = malloc(alloc_edges * sizeof(float));
+    matrix->in_start = calloc(rows + 2, sizeof(size_t));
+    matrix->in_rows = malloc(alloc_edges * sizeof(uint32_t));
+    matrix->in_probs = malloc(alloc_edges * sizeof(float));
+    matrix->terminal = calloc(rows ? rows : 1, 1);
+    matrix->dangling = calloc(rows ? rows : 1, 1);
+    matrix->restart = calloc(rows ? rows : 1, sizeof(double));
+    if (!matrix->out_start || !matrix->out_cols || !matrix->out_probs ||
+        !matrix->in_start || !matrix->in_rows || !matrix->in_probs ||
+        !matrix->terminal || !matrix->dangling || !matrix->restart) {
+        transition_matrix_free(matrix);
+        return 1;
+    }
+
+    // Rows by source, counting the in-degree of every target on the way
+    size_t offset = 0, starts = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        size_t row = mnode->id;
+        matrix->out_start[row] = offset;
+        matrix->terminal[row] = markov_chain->is_last(mnode->data);
+        if (matrix->terminal[row] || mnode->freq_size == 0) {
+            matrix->dangling[row] = 1;
+        }
+        if (!matrix->terminal[row]) {
+            starts++;
+        }
+        if (matrix->dangling[row]) {
+            continue;
+        }
+        long long total = 0;
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            total += mnode->frequency_list[i].frequency;
+        }
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            MarkovNodeFrequency *entry = &mnode->frequency_list[i];
+            uint32_t col = (uint32_t)entry->markov_node->id;
+            matrix->out_cols[offset] = col;
+            matrix->out_probs[offset] = (float)((double)entry->frequency /
+                                                (double)total);
+            matrix->in_start[col + 2]++;
+            offset++;
+        }
+    }
+    matrix->out_start[rows] = offset;
+
+    // Rows by target: prefix sums shifted by one, then a counting scatter
+    for (size_t row = 0; row < rows; row++) {
+        matrix->in_start[row + 2] += matrix->in_start[row + 1];
+    }
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t e = matrix->out_start[row];
+             e < matrix->out_start[row + 1]; e++) {
+            size_t at = matrix->in_start[matrix->out_cols[e] + 1]++;
+            matrix->in_rows[at] = (uint32_t)row;
+            matrix->in_probs[at] = matrix->out_probs[e];
+        }
+    }
+
+    for (size_t row = 0; row < rows; row++) {
+        if (starts == 0) {
+            matrix->restart[row] = 1.0 / (double)rows;
+        } else if (!matrix->terminal[row]) {
+            matrix->restart[row] = 1.0 / (double)starts;
+        }
+    }
+    return 0;
+}
+
+/***************************/
+/*   Multithreaded kernels */
+/***************************/
+
+typedef struct KernelContext {
+    const TransitionMatrix *matrix;
+    int num_threads;
+    size_t *ranges;     // num_threads + 1 row boundaries
+    pthread_barrier_t barrier;
+    double *buffers[2];
+    double *partials;   // 2 * num_threads * PARTIAL_STRIDE
+    double damping;
+    double tolerance;
+    int max_iterations;
+    int result_buffer;  // which of buffers holds the answer
+    AnalysisReport report;
+    int gate;           // 0 while threads start, 1 to run, -1 to give up
+    void *(*body)(void *);
+} KernelContext;
+
+typedef struct KernelThread {
+    KernelContext *ctx;
+    int index;
+} KernelThread;
+
+/**
+ * Thread entry: wait until every worker exists, since the barrier inside
+ * the kernels needs all of them, then run the kernel body.
+ */
+static void *kernel_entry(void *arg) {
+    KernelThread *self = arg;
+    int gate;
+    while ((gate = __atomic_load_n(&self->ctx->gate,
+                                   __ATOMIC_ACQUIRE)) == 0) {
+        sched_yield();
+    }
+    return gate > 0 ? self->ctx->body(self) : NULL;
+}
+
+/**
+ * Split rows into num_threads ranges with about the same number of rows
+ * plus matrix entries, so threads finish their SpMV at the same time.
+ */
+static void balance_rows(const size_t *row_start, size_t rows,
+                         int num_threads, size_t *ranges) {
+    size_t work = rows + row_start[rows];
+    size_t row = 0;
+    ranges[0] = 0;
+    for (int t = 1; t < num_threads; t++) {
+        size_t target = work / (size_t)num_threads * (size_t)t;
+        while (row < rows && row + row_start[row] < target) {
+            row++;
+        }
+        ranges[t] = row;
+    }
+    ranges[num_threads] = rows;
+}
+
+static double sum_partials(const KernelContext *ctx, int bank) {
+    double sum = 0;
+    const double *partials = ctx->partials +
+                             (size_t)bank * ctx->num_threads * PARTIAL_STRIDE;
+    for (int t = 0; t < ctx->num_threads; t++) {
+        sum += partials[(size_t)t * PARTIAL_STRIDE];
+    }
+    return sum;
+}
+
+static double *partial_slot(KernelContext *ctx, int bank, int thread) {
+    return ctx->partials +
+           ((size_t)bank * ctx->num_threads + thread) * PARTIAL_STRIDE;
+}
+
+static void *stationary_thread(void *arg) {
+    KernelThread *self = arg;
+    KernelContext *ctx = self->ctx;
+    const TransitionMatrix *m = ctx->matrix;
+    size_t begin = ctx->ranges[self->index];
+    size_t end = ctx->ranges[self->index + 1];
+    int cur = 0;
+
+    for (int it = 1; it <= ctx->max_iterations; it++) {
+        const double *x = ctx->buffers[cur];
+        double *y = ctx->buffers[1 - cur];
+
+        // Bank 0: probability mass sitting in dangling rows
+        double dangling = 0;
+        for (size_t i = begin; i < end; i++) {
+            if (m->dangling[i]) {
+                dangling += x[i];
+            }
+        }
+        *partial_slot(ctx, 0, self->index) = dangling;
+        pthread_barrier_wait(&ctx->barrier);
+
+        double restart_mass = 1.0 - ctx->damping +
+                              ctx->damping * sum_partials(ctx, 0);
+        double diff = 0;
+        for (size_t j = begin; j < end; j++) {
+            double acc = 0;
+            for (size_t e = m->in_start[j]; e < m->in_start[j + 1]; e++) {
+                acc += x[m->in_rows[e]] * (double)m->in_probs[e];
+            }
+            y[j] = ctx->damping * acc + restart_mass * m->restart[j];
+            diff += fabs(y[j] - x[j]);
+        }
+        // Bank 1: L1 change of this iteration
+        *partial_slot(ctx, 1, self->index) = diff;
+        pthread_barrier_wait(&ctx->barrier);
+
+        double residual = sum_partials(ctx, 1);
+        cur = 1 - cur;
+        if (self->index == 0) {
+            ctx->report.iterations = it;
+            ctx->report.residual = residual;
+            ctx->result_buffer = cur;
+        }
+        if (residual < ctx->tolerance) {
+            if (self->index == 0) {
+                ctx->report.converged = 1;
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *reachability_thread(void *arg) {
+    KernelThread *self = arg;
+    KernelContext *ctx = self->ctx;
+    const TransitionMatrix *m = ctx->matrix;
+    size_t begin = ctx->ranges[self->index];
+    size_t end = ctx->ranges[self->index + 1];
+    int cur = 0;
+
+    for (int step = 1; step <= ctx->max_iterations; step++) {
+        const double *x = ctx->buffers[cur];
+        double *y = ctx->buffers[1 - cur];
+        double diff = 0;
+        for (size_t i = begin; i < end; i++) {
+            double acc = 1.0;
+            if (!m->terminal[i]) {
+                acc = 0;
+                for (size_t e = m->out_start[i]; e < m->out_start[i + 1];
+                     e++) {
+                    acc += (double)m->out_probs[e] * x[m->out_cols[e]];
+                }
+            }
+            y[i] = acc;
+            diff += fabs(acc - x[i]);
+        }
+        // Alternate banks so a fast thread cannot overwrite a partial that
+        // a slow one is still summing
+        *partial_slot(ctx, step & 1, self->index) = diff;
+        pthread_barrier_wait(&ctx->barrier);
+        cur = 1 - cur;
+        if (self->index == 0) {
+            ctx->report.iterations = step;
+            ctx->report.residual = sum_partials(ctx, step & 1);
+            ctx->result_buffer = cur;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Run body on num_threads threads (the caller being one of them) and copy
+ * the resulting vector to out. Falls back to a single thread if workers
+ * cannot be started.
+ */
+static int run_kernel(KernelContext *ctx, const size_t *row_start,
+                      void *(*body)(void *), double *out) {
+    const TransitionMatrix *m = ctx->matrix;
+    int n = ctx->num_threads;
+    ctx->body = body;
+    ctx->gate = 0;
+    pthread_t *threads = malloc((size_t)n * sizeof(pthread_t));
+    KernelThread *selves = malloc((size_t)n * sizeof(KernelThread));
+    if (!threads || !selves) {
+        free(threads);
+        free(selves);
+        return 1;
+    }
+    double start = stopwatch_now();
+    int started = 1;
+    for (int t = 0; t < n; t++) {
+        selves[t] = (KernelThread) {ctx, t};
+    }
+    for (int t = 1; t < n; t++) {
+        if (pthread_create(&threads[t], NULL, kernel_entry, &selves[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started < n) {
+        __atomic_store_n(&ctx->gate, -1, __ATOMIC_RELEASE);
+        for (int t = 1; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        started = 1;
+        n = ctx->num_threads = 1;
+    }
+
+    ctx->ranges = malloc(((size_t)n + 1) * sizeof(size_t));
+    ctx->partials = calloc(2 * (size_t)n * PARTIAL_STRIDE, sizeof(double));
+    int failed = !ctx->ranges || !ctx->partials ||
+                 pthread_barrier_init(&ctx->barrier, NULL, (unsigned)n) != 0;
+    if (failed) {
+        __atomic_store_n(&ctx->gate, -1, __ATOMIC_RELEASE);
+    } else {
+        balance_rows(row_start, m->rows, n, ctx->ranges);
+        __atomic_store_n(&ctx->gate, 1, __ATOMIC_RELEASE);
+        body(&selves[0]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    if (!failed) {
+        pthread_barrier_destroy(&ctx->barrier);
+        memcpy(out, ctx->buffers[ctx->result_buffer],
+               m->rows * sizeof(double));
+    }
+    ctx->report.seconds = stopwatch_now() - start;
+    free(ctx->ranges);
+    free(ctx->partials);
+    free(threads);
+    free(selves);
+    return failed;
+}
+
+static int init_context(KernelContext *ctx, const TransitionMatrix *matrix,
+                        int num_threads) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matrix = matrix;
+    ctx->num_threads = num_threads < 1 ? 1 : num_threads;
+    if ((size_t)ctx->num_threads > matrix->rows && matrix->rows > 0) {
+        ctx->num_threads = (int)matrix->rows;
+    }
+    size_t rows = matrix->rows ? matrix->rows : 1;
+    ctx->buffers[0] = malloc(rows * sizeof(double));
+    ctx->buffers[1] = malloc(rows * sizeof(double));
+    if (!ctx->buffers[0] || !ctx->buffers[1]) {
+        free(ctx->buffers[0]);
+        free(ctx->buffers[1]);
+        return 1;
+    }
+    return 0;
+}
+
+int stationary_distribution(const TransitionMatrix *matrix, double damping,
+                            double tolerance, int max_iterations,
+                            int num_threads, double *out,
+                            AnalysisReport *report) {
+    KernelContext ctx;
+    if (!matrix || !out || matrix->rows == 0 || damping < 0 || damping > 1 ||
+        init_context(&ctx, matrix, num_threads) != 0) {
+        return 1;
+    }
+    memcpy(ctx.buffers[0], matrix->restart, matrix->rows * sizeof(double));
+    ctx.damping = damping;
+    ctx.tolerance = tolerance;
+    ctx.max_iterations = max_iterations;
+    int failed = run_kernel(&ctx, matrix->in_start, stationary_thread, out);
+    if (report) {
+        *report = ctx.report;
+    }
+    free(ctx.buffers[0]);
+    free(ctx.buffers[1]);
+    return failed;
+}
+
+int terminal_reachability(const TransitionMatrix *matrix, int k,
+                          int num_threads, double *out,
+                          AnalysisReport *report) {
+    KernelContext ctx;
+    if (!matrix || !out || matrix->rows == 0 || k < 0 ||
+        init_context(&ctx, matrix, num_threads) != 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < matrix->rows; i++) {
+        ctx.buffers[0][i] = matrix->terminal[i] ? 1.0 : 0.0;
+    }
+    ctx.max_iterations = k;
+    ctx.report.converged = 1;
+    int failed = run_kernel(&ctx, matrix->out_start, reachability_thread, out);
+    if (report) {
+        *report = ctx.report;
+    }
+    free(ctx.buffers[0]);
+    free(ctx.buffers[1]);
+    return failed;
+}
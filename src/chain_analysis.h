@@ -0,0 +1,76 @@
+#ifndef _CHAIN_ANALYSIS_H
+#define _CHAIN_ANALYSIS_H
+
+#include "markov_chain.h"
+#include <stdint.h>
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * A trained chain as a sparse row-stochastic matrix, indexed by node id.
+ * Rows are stored twice in CSR form: by source (P, for k-step queries) and
+ * by target (P transposed, for the stationary distribution), so that both
+ * kernels read their input sequentially and write each output entry from
+ * exactly one thread.
+ */
+typedef struct TransitionMatrix {
+    size_t rows;
+    size_t edges;
+    size_t *out_start;     // rows + 1 offsets into out_cols/out_probs
+    uint32_t *out_cols;
+    float *out_probs;
+    size_t *in_start;      // rows + 1 offsets into in_rows/in_probs
+    uint32_t *in_rows;
+    float *in_probs;
+    unsigned char *terminal; // 1 if the node ends a sequence
+    unsigned char *dangling; // 1 if the row has no transition
+    double *restart;         // where a new sequence starts, sums to 1
+} TransitionMatrix;
+
+typedef struct AnalysisReport {
+    int iterations;
+    double residual;  // L1 change of the last iteration
+    int converged;
+    double seconds;
+} AnalysisReport;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Build the transition matrix of markov_chain. Node ids must be dense (see
+ * renumber_database()). Sequences restart uniformly at a non-terminal node,
+ * like get_first_random_node().
+ * @return 0 on success, 1 otherwise
+ */
+int transition_matrix_build(TransitionMatrix *matrix,
+                            MarkovChain *markov_chain);
+
+void transition_matrix_free(TransitionMatrix *matrix);
+
+/**
+ * Stationary distribution of the chain with restarts, by power iteration:
+ * x' = damping * x P + (1 - damping + dangling mass) * restart.
+ * @param out rows entries, receives the distribution
+ * @param report receives iteration count and convergence, may be NULL
+ * @return 0 on success, 1 otherwise
+ */
+int stationary_distribution(const TransitionMatrix *matrix, double damping,
+                            double tolerance, int max_iterations,
+                            int num_threads, double *out,
+                            AnalysisReport *report);
+
+/**
+ * Probability of reaching a terminal node within k steps from every node.
+ * @param out rows entries, receives the probabilities
+ * @param report receives timing and the change of the last step, may be NULL
+ * @return 0 on success, 1 otherwise
+ */
+int terminal_reachability(const TransitionMatrix *matrix, int k,
+                          int num_threads, double *out,
+                          AnalysisReport *report);
+
+#endif /* _CHAIN_ANALYSIS_H */
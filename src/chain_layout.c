@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_layout.h"
+#include "chain_analysis.h"
+#include "stopwatch.h"
+#include <string.h>
+
+// Generation restarts about every 20 words, which damping models
+#define LAYOUT_DAMPING 0.95
+#define LAYOUT_TOLERANCE 1e-9
+#define LAYOUT_MAX_ITERATIONS 200
+
+typedef struct RankedNode {
+    double key;
+    size_t id;
+} RankedNode;
+
+// Descending key, then ascending id, so the order is reproducible
+static int compare_ranked(const void *a, const void *b) {
+    const RankedNode *x = a;
+    const RankedNode *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? 1 : -1;
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/**
+ * Sort the ids 0 .. n - 1 by descending key into order.
+ * @return 0 on success, 1 on allocation failure
+ */
+static int rank_by_key(const double *key, size_t n, size_t *order) {
+    RankedNode *ranked = malloc(n * sizeof(RankedNode));
+    if (!ranked) {
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ranked[i].key = key[i];
+        ranked[i].id = i;
+    }
+    qsort(ranked, n, sizeof(RankedNode), compare_ranked);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = ranked[i].id;
+    }
+    free(ranked);
+    return 0;
+}
+
+static int stationary_order(MarkovChain *markov_chain, size_t n,
+                            size_t *order) {
+    TransitionMatrix matrix;
+    if (transition_matrix_build(&matrix, markov_chain) != 0) {
+        return 1;
+    }
+    double *probability = malloc(n * sizeof(double));
+    int failed = !probability ||
+                 stationary_distribution(&matrix, LAYOUT_DAMPING,
+                                         LAYOUT_TOLERANCE,
+                                         LAYOUT_MAX_ITERATIONS, 1,
+                                         probability, NULL) != 0 ||
+                 rank_by_key(probability, n, order) != 0;
+    free(probability);
+    transition_matrix_free(&matrix);
+    return failed;
+}
+
+/**
+ * Depth first search that starts from the words with the most incoming
+ * transitions and follows successors by descending frequency (the lists
+ * are sorted), so a word is mostly followed in memory by its likeliest
+ * successor, and that one by its own.
+ */
+static int dfs_order(MarkovNode **nodes, size_t n, size_t edges,
+                     size_t *order) {
+    double *weight = calloc(n, sizeof(double));
+    size_t *seeds = malloc(n * sizeof(size_t));
+    unsigned char *visited = calloc(n, 1);
+    // Every word is pushed once as a seed and once per transition at most
+    size_t *stack = malloc((n + edges) * sizeof(size_t));
+    if (!weight || !seeds || !visited || !stack) {
+        free(weight);
+        free(seeds);
+        free(visited);
+        free(stack);
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < nodes[i]->freq_size; k++) {
+            MarkovNodeFrequency *entry = &nodes[i]->frequency_list[k];
+            weight[entry->markov_node->id] += entry->frequency;
+        }
+    }
+    int failed = rank_by_key(weight, n, seeds);
+    size_t placed = 0;
+    for (size_t s = 0; !failed && s < n; s++) {
+        if (visited[seeds[s]]) {
+            continue;
+        }
+        size_t depth = 0;
+        stack[depth++] = seeds[s];
+        while (depth > 0) {
+            size_t id = stack[--depth];
+            if (visited[id]) {
+                continue;
+            }
+            visited[id] = 1;
+            order[placed++] = id;
+            MarkovNode *node = nodes[id];
+            // Pushed in reverse, so the likeliest is placed next
+            for (size_t k = node->freq_size; k-- > 0;) {
+                size_t next = node->frequency_list[k].markov_node->id;
+                if (!visited[next]) {
+                    stack[depth++] = next;
+                }
+            }
+        }
+    }
+    free(weight);
+    free(seeds);
+    free(visited);
+    free(stack);
+    return failed;
+}
+
+static size_t node_bytes(const MarkovNode *node) {
+    return sizeof(MarkovNode) +
+           node->freq_capacity * sizeof(MarkovNodeFrequency) +
+           successor_index_bytes(node);
+}
+
+int optimize_chain_layout(MarkovChain *markov_chain, LayoutOrder order,
+                          LayoutStats *stats) {
+    if (!markov_chain || !markov_chain->database) {
+        return EXIT_FAILURE;
+    }
+    double start = stopwatch_now();
+    LayoutStats local;
+    memset(&local, 0, sizeof(local));
+    renumber_database(markov_chain);
+    sort_frequency_lists(markov_chain);
+
+    size_t n = (size_t)markov_chain->database->size;
+    if (n == 0) {
+        if (stats) {
+            *stats = local;
+        }
+        return EXIT_SUCCESS;
+    }
+    MarkovNode **old = malloc(n * sizeof(MarkovNode *));
+    Node **links = malloc(n * sizeof(Node *));
+    MarkovNode **fresh = calloc(n, sizeof(MarkovNode *));
+    size_t *rank = malloc(n * sizeof(size_t));  // position -> old id
+    int failed = !old || !links || !fresh || !rank;
+    if (!failed) {
+        for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+            MarkovNode *mnode = cur->data;
+            old[mnode->id] = mnode;
+            links[mnode->id] = cur;
+            local.edges += mnode->freq_size;
+            local.bytes_before += node_bytes(mnode);
+        }
+        failed = order == LAYOUT_DFS ?
+                 dfs_order(old, n, local.edges, rank) :
+                 stationary_order(markov_chain, n, rank);
+    }
+
+    // Copies are made while the originals are still allocated, so the
+    // allocator hands them out from fresh memory, in order
+    for (size_t pos = 0; !failed && pos < n; pos++) {
+        MarkovNode *src = old[rank[pos]];
+        MarkovNode *copy = malloc(sizeof(MarkovNode));
+        MarkovNodeFrequency *list = src->freq_size ?
+            malloc(src->freq_size * sizeof(MarkovNodeFrequency)) : NULL;
+        if (!copy || (src->freq_size && !list)) {
+            free(copy);
+            free(list);
+            failed = 1;
+            break;
+        }
+        *copy = *src;
+        if (list) {
+            memcpy(list, src->frequency_list,
+                   src->freq_size * sizeof(MarkovNodeFrequency));
+        }
+        copy->frequency_list = list;
+        copy->freq_capacity = src->freq_size;
+        copy->successor_index = NULL;
+        copy->id = pos;
+        fresh[rank[pos]] = copy;
+    }
+    if (failed) {
+        for (size_t i = 0; fresh && i < n; i++) {
+            if (fresh[i]) {
+                free(fresh[i]->frequency_list);
+                free(fresh[i]);
+            }
+        }
+        free(old);
+        free(links);
+        free(fresh);
+        free(rank);
+        return EXIT_FAILURE;
+    }
+
+    // The originals still hold the old ids the successors are mapped by
+    for (size_t i = 0; i < n; i++) {
+        MarkovNode *copy = fresh[i];
+        for (size_t k = 0; k < copy->freq_size; k++) {
+            MarkovNodeFrequency *entry = &copy->frequency_list[k];
+            entry->markov_node = fresh[entry->markov_node->id];
+        }
+        local.bytes_after += node_bytes(copy);
+    }
+    LinkedList *database = markov_chain->database;
+    for (size_t pos = 0; pos < n; pos++) {
+        Node *link = links[rank[pos]];
+        link->data = fresh[rank[pos]];
+        link->next = pos + 1 < n ? links[rank[pos + 1]] : NULL;
+    }
+    database->first = links[rank[0]];
+    database->last = links[rank[n - 1]];
+    for (size_t i = 0; i < n; i++) {
+        drop_successor_index(old[i]);
+        free(old[i]->frequency_list);
+        free(old[i]);
+    }
+    free(old);
+    free(links);
+    free(fresh);
+    free(rank);
+
+    local.nodes = n;
+    local.seconds = stopwatch_now() - start;
+    if (stats) {
+        *stats = local;
+    }
+    return EXIT_SUCCESS;
+}
+
+int parse_layout_order(const char *name, LayoutOrder *order) {
+    if (strcmp(name, "stationary") == 0) {
+        *order = LAYOUT_STATIONARY;
+    } else if (strcmp(name, "dfs") == 0) {
+        *order = LAYOUT_DFS;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+void print_layout_stats(FILE *out, const LayoutStats *stats) {
+    if (!out || !stats) {
+        return;
+    }
+    fprintf(out, "Layout: %zu words, %zu transitions relocated in %.3f s\n",
+            stats->nodes, stats->edges, stats->seconds);
+    fprintf(out, "  %.1f KB before, %.1f KB after\n",
+            stats->bytes_before / 1024.0, stats->bytes_after / 1024.0);
+}
@@ -0,0 +1,55 @@
+#ifndef _CHAIN_LAYOUT_H
+#define _CHAIN_LAYOUT_H
+
+#include "markov_chain.h"
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Order in which optimize_chain_layout() places the nodes.
+ */
+typedef enum LayoutOrder {
+    LAYOUT_DFS,         // depth first from the most frequent words
+    LAYOUT_STATIONARY   // by descending stationary probability
+} LayoutOrder;
+
+typedef struct LayoutStats {
+    size_t nodes;
+    size_t edges;
+    size_t bytes_before;  // nodes and frequency lists
+    size_t bytes_after;
+    double seconds;
+} LayoutStats;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Rearrange a trained chain for generation. Every frequency list is sorted
+ * by descending frequency, so most samples stop after a few entries. Nodes
+ * are then renumbered in the given order, the database is relinked in that
+ * order, and every node and its list are copied to fresh memory one after
+ * the other, lists trimmed to their size. Words that generation visits
+ * together end up on neighbouring cache lines and pages.
+ *
+ * Sampling probabilities are unchanged, but the same random stream picks
+ * different words than before. Training may go on afterwards.
+ * @param stats receives sizes and timing, may be NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on allocation failure (the
+ *         chain is then unchanged, apart from sorted lists)
+ */
+int optimize_chain_layout(MarkovChain *markov_chain, LayoutOrder order,
+                          LayoutStats *stats);
+
+/**
+ * Parse "dfs" or "stationary".
+ * @return 0 on success, 1 if name is neither
+ */
+int parse_layout_order(const char *name, LayoutOrder *order);
+
+void print_layout_stats(FILE *out, const LayoutStats *stats);
+
+#endif /* _CHAIN_LAYOUT_H */
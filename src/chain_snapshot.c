@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_snapshot.h"
+#include "stopwatch.h"
+#include <string.h>
+
+static void free_snapshot(ChainSnapshot *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+    free(snapshot->data);
+    free(snapshot->row_start);
+    free(snapshot->successors);
+    free(snapshot->cumulative);
+    free(snapshot->terminal);
+    free(snapshot->starts);
+    free(snapshot);
+}
+
+/**
+ * Copy the transitions of markov_chain. Node ids must be dense.
+ */
+static ChainSnapshot *build_snapshot(MarkovChain *markov_chain) {
+    ChainSnapshot *snapshot = calloc(1, sizeof(ChainSnapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+    size_t rows = (size_t)markov_chain->database->size;
+    size_t edges = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        edges += ((MarkovNode *)cur->data)->freq_size;
+    }
+    size_t alloc_rows = rows ? rows : 1;
+    size_t alloc_edges = edges ? edges : 1;
+    snapshot->rows = rows;
+    snapshot->data = malloc(alloc_rows * sizeof(void *));
+    snapshot->row_start = malloc((rows + 1) * sizeof(size_t));
+    snapshot->successors = malloc(alloc_edges * sizeof(uint32_t));
+    snapshot->cumulative = malloc(alloc_edges * sizeof(uint64_t));
+    snapshot->terminal = malloc(alloc_rows);
+    snapshot->starts = malloc(alloc_rows * sizeof(uint32_t));
+    if (!snapshot->data || !snapshot->row_start || !snapshot->successors ||
+        !snapshot->cumulative || !snapshot->terminal || !snapshot->starts) {
+        free_snapshot(snapshot);
+        return NULL;
+    }
+
+    // Rows are visited in id order, so offsets come out ascending
+    size_t offset = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        size_t row = mnode->id;
+        snapshot->data[row] = mnode->data;
+        snapshot->row_start[row] = offset;
+        snapshot->terminal[row] = markov_chain->is_last(mnode->data);
+        if (!snapshot->terminal[row]) {
+            snapshot->starts[snapshot->num_starts++] = (uint32_t)row;
+        }
+        uint64_t running = 0;
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            running += (uint64_t)mnode->frequency_list[i].frequency;
+            snapshot->successors[offset] =
+                (uint32_t)mnode->frequency_list[i].markov_node->id;
+            snapshot->cumulative[offset] = running;
+            offset++;
+        }
+    }
+    snapshot->row_start[rows] = offset;
+    return snapshot;
+}
+
+int snapshot_domain_init(SnapshotDomain *domain, int max_readers) {
+    if (!domain || max_readers < 1) {
+        return 1;
+    }
+    memset(domain, 0, sizeof(*domain));
+    domain->readers = calloc((size_t)max_readers, sizeof(SnapshotReader));
+    if (!domain->readers) {
+        return 1;
+    }
+    domain->max_readers = max_readers;
+    domain->global_epoch = 1;
+    return 0;
+}
+
+void snapshot_domain_destroy(SnapshotDomain *domain) {
+    if (!domain) {
+        return;
+    }
+    free_snapshot(domain->current);
+    while (domain->retired) {
+        ChainSnapshot *next = domain->retired->next_retired;
+        free_snapshot(domain->retired);
+        domain->retired = next;
+    }
+    free(domain->readers);
+    memset(domain, 0, sizeof(*domain));
+}
+
+/**
+ * Free the retired snapshots that no reader can hold any more: those
+ * retired before the oldest epoch announced by an active reader.
+ */
+static void reclaim(SnapshotDomain *domain) {
+    size_t oldest = __atomic_load_n(&domain->global_epoch, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < domain->max_readers; i++) {
+        size_t epoch = __atomic_load_n(&domain->readers[i].epoch,
+                                       __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    ChainSnapshot **link = &domain->retired;
+    while (*link) {
+        ChainSnapshot *snapshot = *link;
+        if (snapshot->retire_epoch < oldest) {
+            *link = snapshot->next_retired;
+            free_snapshot(snapshot);
+            domain->reclaimed++;
+        } else {
+            link = &snapshot->next_retired;
+        }
+    }
+}
+
+int snapshot_publish(SnapshotDomain *domain, MarkovChain *markov_chain) {
+    if (!domain || !markov_chain || !markov_chain->database) {
+        return 1;
+    }
+    double start = stopwatch_now();
+    ChainSnapshot *snapshot = build_snapshot(markov_chain);
+    domain->build_seconds += stopwatch_now() - start;
+    if (!snapshot) {
+        return 1;
+    }
+    domain->rows_copied += snapshot->rows;
+    domain->edges_copied += snapshot->row_start[snapshot->rows];
+    snapshot->version = ++domain->published;
+    ChainSnapshot *old = __atomic_exchange_n(&domain->current, snapshot,
+                                             __ATOMIC_SEQ_CST);
+    if (old) {
+        // A reader announcing this epoch or later loaded the new pointer
+        old->retire_epoch = __atomic_fetch_add(&domain->global_epoch, 1,
+                                               __ATOMIC_SEQ_CST);
+        old->next_retired = domain->retired;
+        domain->retired = old;
+    }
+    reclaim(domain);
+    return 0;
+}
+
+const ChainSnapshot *snapshot_acquire(SnapshotDomain *domain, int reader) {
+    size_t epoch = __atomic_load_n(&domain->global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&domain->readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&domain->current, __ATOMIC_SEQ_CST);
+}
+
+void snapshot_release(SnapshotDomain *domain, int reader) {
+    __atomic_store_n(&domain->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+int snapshot_generate(const ChainSnapshot *snapshot, MarkovRng *rng,
+                      uint32_t *out, int max_length) {
+    if (!snapshot || snapshot->num_starts == 0 || max_length < 1) {
+        return 0;
+    }
+    uint32_t row = snapshot->starts[markov_rng_below(rng,
+                                                     snapshot->num_starts)];
+    int length = 0;
+    for (;;) {
+        out[length++] = row;
+        size_t lo = snapshot->row_start[row];
+        size_t hi = snapshot->row_start[row + 1];
+        if (length == max_length || snapshot->terminal[row] || lo == hi) {
+            return length;
+        }
+        uint64_t pick = markov_rng_below(rng, snapshot->cumulative[hi - 1]);
+        // First successor whose running total exceeds pick
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (snapshot->cumulative[mid] <= pick) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        row = snapshot->successors[lo];
+    }
+}
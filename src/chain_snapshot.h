@@ -0,0 +1,105 @@
+#ifndef _CHAIN_SNAPSHOT_H
+#define _CHAIN_SNAPSHOT_H
+
+#include "markov_chain.h"
+#include <stdint.h>
+
+#define SNAPSHOT_CACHE_LINE 64
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Immutable copy of a chain's transitions at one point of training.
+ * Successors of a row are stored with running frequency totals, so a
+ * sample is one binary search. data points at the payloads of the live
+ * chain, which training never moves or frees.
+ */
+typedef struct ChainSnapshot {
+    size_t version;
+    size_t rows;
+    void **data;            // payload of every row
+    size_t *row_start;      // rows + 1 offsets into successors/cumulative
+    uint32_t *successors;
+    uint64_t *cumulative;   // running frequency totals within a row
+    unsigned char *terminal;
+    uint32_t *starts;       // non-terminal rows, for a random first word
+    size_t num_starts;
+
+    struct ChainSnapshot *next_retired;
+    size_t retire_epoch;
+} ChainSnapshot;
+
+// Epoch announced by one reader, alone on its cache line
+typedef struct SnapshotReader {
+    size_t epoch;  // 0 while outside a read section
+    char pad[SNAPSHOT_CACHE_LINE - sizeof(size_t)];
+} SnapshotReader;
+
+/**
+ * Publication point between one writer and up to max_readers readers.
+ * The writer swaps in a new snapshot atomically and retires the old one;
+ * retired snapshots are freed once every reader has moved past the epoch
+ * of their retirement (epoch-based reclamation). Readers never take a lock
+ * and the writer never waits for readers.
+ */
+typedef struct SnapshotDomain {
+    ChainSnapshot *current;
+    size_t global_epoch;
+    SnapshotReader *readers;
+    int max_readers;
+    ChainSnapshot *retired;  // writer-private list, newest first
+    size_t published;
+    size_t reclaimed;
+    double build_seconds;     // writer time spent copying the chain
+    unsigned long long rows_copied;
+    unsigned long long edges_copied;
+} SnapshotDomain;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * @return 0 on success, 1 otherwise
+ */
+int snapshot_domain_init(SnapshotDomain *domain, int max_readers);
+
+/**
+ * Free every snapshot. No reader may be inside a read section.
+ */
+void snapshot_domain_destroy(SnapshotDomain *domain);
+
+/**
+ * Writer side: copy markov_chain into a new snapshot, publish it and
+ * reclaim retired snapshots that no reader can still see. The copy costs
+ * O(rows + edges); callers that publish while training should space
+ * publications in proportion to the size of the chain.
+ * @return 0 on success, 1 on allocation failure (the old one stays current)
+ */
+int snapshot_publish(SnapshotDomain *domain, MarkovChain *markov_chain);
+
+/**
+ * Reader side: enter a read section and return the current snapshot, which
+ * stays valid until snapshot_release(). May return NULL before the first
+ * publication.
+ * @param reader index of the calling reader, 0 .. max_readers - 1
+ */
+const ChainSnapshot *snapshot_acquire(SnapshotDomain *domain, int reader);
+
+/**
+ * Leave the read section entered by snapshot_acquire().
+ */
+void snapshot_release(SnapshotDomain *domain, int reader);
+
+/**
+ * Sample a sequence from snapshot into out, starting at a random
+ * non-terminal row, until a terminal row, a row without successors or
+ * max_length rows.
+ * @return number of rows written to out
+ */
+int snapshot_generate(const ChainSnapshot *snapshot, MarkovRng *rng,
+                      uint32_t *out, int max_length);
+
+#endif /* _CHAIN_SNAPSHOT_H */
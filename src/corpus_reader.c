@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+#include "corpus_reader.h"
+#include "markov_chain.h"
+#include "stopwatch.h"
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define CORPUS_BUFFER_BYTES (1 << 20)
+// Queue capacity too, so returning a buffer never waits
+#define CORPUS_BUFFERS 4
+#define GZIP_MAGIC_0 0x1f
+#define GZIP_MAGIC_1 0x8b
+
+/**
+ * A run of uncompressed text. A buffer with length 0 ends the stream.
+ */
+typedef struct CorpusBuffer {
+    size_t length;
+    int error;
+    char data[CORPUS_BUFFER_BYTES];
+} CorpusBuffer;
+
+#ifdef HAVE_ZLIB
+/**
+ * Inflate thread: fill empty buffers with text until the end of the file.
+ */
+static void *inflate_thread(void *arg) {
+    CorpusReader *reader = arg;
+    unsigned long long stalls = 0;
+    double wait_seconds = 0;
+    for (;;) {
+        CorpusBuffer *buffer = spsc_queue_pop_wait(&reader->empty,
+                                                   &reader->stop, &stalls,
+                                                   &wait_seconds);
+        if (!buffer) {
+            break;
+        }
+        double start = stopwatch_now();
+        int read = gzread((gzFile)reader->gz, buffer->data,
+                          CORPUS_BUFFER_BYTES);
+        reader->stats.inflate_seconds += stopwatch_now() - start;
+        buffer->length = read > 0 ? (size_t)read : 0;
+        buffer->error = read < 0;
+        if (read == 0) {
+            // A truncated stream ends like a complete one, but flags it
+            int status;
+            gzerror((gzFile)reader->gz, &status);
+            buffer->error = status != Z_OK;
+        }
+        if (!spsc_queue_push_wait(&reader->filled, buffer, &reader->stop,
+                                  &stalls, &wait_seconds) || read <= 0) {
+            break;
+        }
+    }
+    reader->stats.file_bytes = (unsigned long long)gzoffset((gzFile)reader->gz);
+    return NULL;
+}
+
+static int open_compressed(CorpusReader *reader, const char *path) {
+    // The caller reports a file that cannot be opened
+    reader->gz = gzopen(path, "rb");
+    if (!reader->gz ||
+        gzbuffer((gzFile)reader->gz, CORPUS_BUFFER_BYTES) != 0) {
+        return EXIT_FAILURE;
+    }
+    reader->buffers = malloc(CORPUS_BUFFERS * sizeof(CorpusBuffer));
+    if (!reader->buffers ||
+        spsc_queue_init(&reader->filled, CORPUS_BUFFERS) != 0 ||
+        spsc_queue_init(&reader->empty, CORPUS_BUFFERS) != 0) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < CORPUS_BUFFERS; i++) {
+        spsc_queue_push(&reader->empty, &reader->buffers[i]);
+    }
+    if (pthread_create(&reader->thread, NULL, inflate_thread, reader) != 0) {
+        printf("Error: Failed to start the decompression thread.\n");
+        return EXIT_FAILURE;
+    }
+    reader->running = 1;
+    return EXIT_SUCCESS;
+}
+#endif
+
+int corpus_reader_open(CorpusReader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(path, "r");
+    if (!reader->fp) {
+        return EXIT_FAILURE;
+    }
+    int magic0 = fgetc(reader->fp);
+    int magic1 = fgetc(reader->fp);
+    if (magic0 != GZIP_MAGIC_0 || magic1 != GZIP_MAGIC_1) {
+        rewind(reader->fp);
+        return EXIT_SUCCESS;
+    }
+    fclose(reader->fp);
+    reader->fp = NULL;
+    reader->stats.compressed = 1;
+#ifdef HAVE_ZLIB
+    if (open_compressed(reader, path) != EXIT_SUCCESS) {
+        corpus_reader_close(reader);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+#else
+    printf("Error: '%s' is gzip-compressed, but this build has no zlib "
+           "support.\n", path);
+    return EXIT_FAILURE;
+#endif
+}
+
+/**
+ * Make sure the current buffer has unread text, trading it for the next
+ * one when it is used up.
+ * @return 0 if there is text, 1 at the end of the stream
+ */
+static int next_buffer(CorpusReader *reader) {
+    if (reader->current && reader->pos < reader->current->length) {
+        return 0;
+    }
+    if (reader->eof) {
+        return 1;
+    }
+    if (reader->current) {
+        spsc_queue_push(&reader->empty, reader->current);
+    }
+    reader->current = spsc_queue_pop_wait(&reader->filled, &reader->stop,
+                                          &reader->stats.stalls,
+                                          &reader->stats.wait_seconds);
+    reader->pos = 0;
+    if (!reader->current || reader->current->length == 0) {
+        reader->error = !reader->current || reader->current->error;
+        reader->current = NULL;
+        reader->eof = 1;
+        return 1;
+    }
+    return 0;
+}
+
+char *corpus_reader_gets(char *line, int size, CorpusReader *reader) {
+    if (size < 1) {
+        return NULL;
+    }
+    if (reader->fp) {
+        char *result = fgets(line, size, reader->fp);
+        if (result) {
+            reader->stats.text_bytes += strlen(result);
+        }
+        return result;
+    }
+    size_t copied = 0;
+    size_t room = (size_t)size - 1;
+    while (copied < room && next_buffer(reader) == 0) {
+        CorpusBuffer *buffer = reader->current;
+        size_t take = buffer->length - reader->pos;
+        if (take > room - copied) {
+            take = room - copied;
+        }
+        const char *text = buffer->data + reader->pos;
+        const char *newline = memchr(text, '\n', take);
+        if (newline) {
+            take = (size_t)(newline - text) + 1;
+        }
+        memcpy(line + copied, text, take);
+        copied += take;
+        reader->pos += take;
+        if (newline) {
+            break;
+        }
+    }
+    if (copied == 0) {
+        return NULL;
+    }
+    line[copied] = '\0';
+    reader->stats.text_bytes += copied;
+    return line;
+}
+
+void corpus_reader_close(CorpusReader *reader) {
+    if (!reader) {
+        return;
+    }
+    if (reader->fp) {
+        reader->stats.file_bytes = reader->stats.text_bytes;
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+#ifdef HAVE_ZLIB
+    if (reader->running) {
+        __atomic_store_n(&reader->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(reader->thread, NULL);
+        reader->running = 0;
+    }
+    if (reader->gz) {
+        gzclose((gzFile)reader->gz);
+        reader->gz = NULL;
+    }
+#endif
+    spsc_queue_destroy(&reader->filled);
+    spsc_queue_destroy(&reader->empty);
+    free(reader->buffers);
+    reader->buffers = NULL;
+    reader->current = NULL;
+}
+
+void print_corpus_stats(FILE *out, const CorpusStats *stats, double seconds) {
+    if (!out || !stats) {
+        return;
+    }
+    double text_mb = stats->text_bytes / 1048576.0;
+    double file_mb = stats->file_bytes / 1048576.0;
+    fprintf(out, "Input: %s, %.2f MB of text from %.2f MB read in %.3f s "
+            "(%.1f MB/s of text, %.1f MB/s from disk)\n",
+            stats->compressed ? "gzip" : "plain", text_mb, file_mb, seconds,
+            seconds > 0 ? text_mb / seconds : 0.0,
+            seconds > 0 ? file_mb / seconds : 0.0);
+    if (stats->compressed) {
+        fprintf(out, "  inflate thread busy %.3f s; reader waited %llu times "
+                "(%.3f s)\n", stats->inflate_seconds, stats->stalls,
+                stats->wait_seconds);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _CORPUS_READER_H
+#define _CORPUS_READER_H
+
+#include "spsc_queue.h"
+#include <pthread.h>
+#include <stdio.h>
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+typedef struct CorpusStats {
+    int compressed;                  // 1 for gzip input
+    unsigned long long file_bytes;   // bytes read from the file
+    unsigned long long text_bytes;   // bytes of text handed out
+    unsigned long long stalls;       // times the reader waited for text
+    double wait_seconds;             // time spent in those waits
+    double inflate_seconds;          // time the thread spent decompressing
+} CorpusStats;
+
+/**
+ * Line reader over a plain or gzip-compressed corpus, picked by the magic
+ * bytes of the file. Plain files are read with fgets() on the calling
+ * thread. Compressed files are inflated by a thread of their own into a
+ * ring of large buffers that go through a pair of SpscQueues, so
+ * decompression overlaps with whatever the caller does with the lines.
+ * Either way corpus_reader_gets() returns exactly what fgets() would on
+ * the uncompressed text.
+ *
+ * gzip input needs zlib at build time (HAVE_ZLIB); without it, opening a
+ * compressed file fails with an error.
+ */
+typedef struct CorpusReader {
+    FILE *fp;                 // plain input, NULL for gzip
+    void *gz;                 // gzFile of compressed input
+    struct CorpusBuffer *buffers;
+    SpscQueue filled;         // inflate thread -> reader
+    SpscQueue empty;          // reader -> inflate thread
+    struct CorpusBuffer *current;  // buffer being read, NULL if none
+    size_t pos;               // next byte of current
+    int eof;
+    int error;                // 1 if the input could not be decompressed
+    int stop;                 // raised by corpus_reader_close()
+    int running;              // 1 while the inflate thread is started
+    pthread_t thread;
+    CorpusStats stats;
+} CorpusReader;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Open the corpus at path, starting the inflate thread if it is gzip.
+ * Prints an error message on allocation failure or if the build cannot
+ * read gzip, but not if the file cannot be opened.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int corpus_reader_open(CorpusReader *reader, const char *path);
+
+/**
+ * Read one line, like fgets(line, size, fp) on the uncompressed text.
+ * @return line, or NULL at the end of the corpus or on a decompression
+ *         error (see reader->error)
+ */
+char *corpus_reader_gets(char *line, int size, CorpusReader *reader);
+
+/**
+ * Stop the inflate thread and close the file.
+ */
+void corpus_reader_close(CorpusReader *reader);
+
+/**
+ * Print the counters of stats, with throughput over seconds of ingestion.
+ */
+void print_corpus_stats(FILE *out, const CorpusStats *stats, double seconds);
+
+#endif /* _CORPUS_READER_H */
@@ -0,0 +1,710 @@
+#define _POSIX_C_SOURCE 200809L
+#include "external_train.h"
+#include "node_index.h"
+#include "stopwatch.h"
+#include <stdint.h>
+#include <string.h>
+
+#define DELIMITERS " \n\t\r"
+#define LINE_MAX 1001
+// Smallest read buffer given to one run while merging
+#define MIN_RUN_BUFFER_BYTES 4096
+#define MIN_BUFFER_RECORDS 64
+
+/**
+ * One bigram with its count. first is the ordinal of its first occurrence
+ * in the corpus, which fixes the order of the frequency lists.
+ */
+typedef struct PairRecord {
+    uint32_t from;
+    uint32_t to;
+    uint32_t count;
+    uint32_t pad;
+    uint64_t first;
+} PairRecord;
+
+// A sorted, aggregated run of PairRecords in a temporary file
+typedef struct Run {
+    FILE *fp;
+    size_t count;
+} Run;
+
+typedef struct RunReader {
+    FILE *fp;
+    long offset;       // position of the next record not read yet in fp
+    PairRecord *buf;
+    size_t len;        // records in buf
+    size_t pos;        // next record in buf
+    size_t remaining;  // records of the run not read yet
+} RunReader;
+
+typedef struct ExternalRun {
+    MarkovChain *markov_chain;
+    size_t budget_bytes;
+    PairRecord *buffer;
+    size_t capacity;
+    size_t used;
+    Run *runs;
+    size_t num_runs;
+    size_t runs_capacity;
+    MarkovNode **nodes;  // node of every id, filled after the scan
+    PairRecord *row;     // successors of the row being written
+    size_t row_capacity; // its share of the budget, in records
+    uint32_t row_from;   // word of the row being written
+    FILE *row_file;      // parts of a row too long for row, by first
+    size_t row_spilled;  // records of the row in row_file
+    ExternalStats *stats;
+} ExternalRun;
+
+static int compare_pairs(const void *a, const void *b) {
+    const PairRecord *x = a;
+    const PairRecord *y = b;
+    if (x->from != y->from) {
+        return (x->from > y->from) - (x->from < y->from);
+    }
+    return (x->to > y->to) - (x->to < y->to);
+}
+
+static int compare_first(const void *a, const void *b) {
+    uint64_t x = ((const PairRecord *)a)->first;
+    uint64_t y = ((const PairRecord *)b)->first;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fold rec into last if they are the same pair.
+ * @return 1 if folded, 0 otherwise
+ */
+static int fold_pair(PairRecord *last, const PairRecord *rec) {
+    if (last->from != rec->from || last->to != rec->to) {
+        return 0;
+    }
+    last->count += rec->count;
+    if (rec->first < last->first) {
+        last->first = rec->first;
+    }
+    return 1;
+}
+
+/**
+ * Sort records and sum the counts of equal pairs.
+ * @return number of distinct pairs left at the front of records
+ */
+static size_t sort_and_aggregate(PairRecord *records, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(records, count, sizeof(PairRecord), compare_pairs);
+    size_t out = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (!fold_pair(&records[out], &records[i])) {
+            records[++out] = records[i];
+        }
+    }
+    return out + 1;
+}
+
+static int push_run(ExternalRun *ext, FILE *fp, size_t count) {
+    if (ext->num_runs == ext->runs_capacity) {
+        size_t capacity = ext->runs_capacity ? ext->runs_capacity * 2 : 8;
+        Run *runs = realloc(ext->runs, capacity * sizeof(Run));
+        if (!runs) {
+            return EXIT_FAILURE;
+        }
+        ext->runs = runs;
+        ext->runs_capacity = capacity;
+    }
+    ext->runs[ext->num_runs].fp = fp;
+    ext->runs[ext->num_runs].count = count;
+    ext->num_runs++;
+    return EXIT_SUCCESS;
+}
+
+static int write_records(ExternalRun *ext, FILE *fp, const PairRecord *records,
+                         size_t count) {
+    if (fwrite(records, sizeof(PairRecord), count, fp) != count) {
+        printf("Error: Failed to write a run to a temporary file.\n");
+        return EXIT_FAILURE;
+    }
+    ext->stats->spilled_bytes += count * sizeof(PairRecord);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Make room in the full pair buffer: aggregate it in place, and spill it
+ * as a new run unless that freed at least a quarter of it.
+ */
+static int flush_buffer(ExternalRun *ext) {
+    ext->used = sort_and_aggregate(ext->buffer, ext->used);
+    if (ext->used <= ext->capacity - ext->capacity / 4) {
+        return EXIT_SUCCESS;
+    }
+    FILE *fp = tmpfile();
+    if (!fp) {
+        printf("Error: Failed to create a temporary file.\n");
+        return EXIT_FAILURE;
+    }
+    if (write_records(ext, fp, ext->buffer, ext->used) != EXIT_SUCCESS ||
+        push_run(ext, fp, ext->used) != EXIT_SUCCESS) {
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+    ext->stats->runs++;
+    ext->used = 0;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Intern the words of corpus into the chain and collect their pairs, spilling
+ * runs as the buffer fills. Tokenizes like fill_database().
+ */
+static int scan_corpus(ExternalRun *ext, CorpusReader *corpus,
+                       int words_to_read, hash_func hash) {
+    MarkovChain *markov_chain = ext->markov_chain;
+    NodeIndex index;
+    if (node_index_init(&index, 1024, hash, markov_chain->comp_func) != 0) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    char line[LINE_MAX];
+    int words_processed = 0;
+    uint64_t ordinal = 0;
+    int result = EXIT_SUCCESS;
+    while (result == EXIT_SUCCESS &&
+           corpus_reader_gets(line, LINE_MAX, corpus)) {
+        MarkovNode *prev = NULL;
+        char *token = strtok(line, DELIMITERS);
+        while (token != NULL && (words_to_read == EXTERNAL_READ_ALL ||
+                                 words_processed < words_to_read)) {
+            MarkovNode *current;
+            const NodeIndexSlot *slot = node_index_find(&index, token);
+            if (slot) {
+                current = slot->node;
+            } else {
+                Node *node = append_to_database(markov_chain, token);
+                if (!node) {
+                    result = EXIT_FAILURE;
+                    break;
+                }
+                current = node->data;
+                if (node_index_insert(&index, current, current->id) != 0) {
+                    printf(ALLOCATION_ERROR_MESSAGE);
+                    result = EXIT_FAILURE;
+                    break;
+                }
+            }
+            if (prev && !markov_chain->is_last(prev->data)) {
+                if (ext->used == ext->capacity &&
+                    flush_buffer(ext) != EXIT_SUCCESS) {
+                    result = EXIT_FAILURE;
+                    break;
+                }
+                PairRecord *rec = &ext->buffer[ext->used++];
+                rec->from = (uint32_t)prev->id;
+                rec->to = (uint32_t)current->id;
+                rec->count = 1;
+                rec->pad = 0;
+                rec->first = ordinal++;
+                ext->stats->pairs++;
+            }
+            prev = current;
+            token = strtok(NULL, DELIMITERS);
+            words_processed++;
+        }
+        if (words_to_read != EXTERNAL_READ_ALL &&
+            words_processed >= words_to_read) {
+            break;
+        }
+    }
+    node_index_destroy(&index);
+    return result;
+}
+
+/**
+ * Give from a frequency list of count entries.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on allocation failure
+ */
+static int start_row(ExternalRun *ext, MarkovNode *from, size_t count) {
+    from->frequency_list = malloc(count * sizeof(MarkovNodeFrequency));
+    if (!from->frequency_list) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    from->freq_size = count;
+    from->freq_capacity = count;
+    ext->stats->distinct += count;
+    return EXIT_SUCCESS;
+}
+
+static void set_successor(ExternalRun *ext, MarkovNode *from, size_t i,
+                          const PairRecord *rec) {
+    MarkovNode *to = ext->nodes[rec->to];
+    from->frequency_list[i].markov_node = to;
+    from->frequency_list[i].frequency = (int)rec->count;
+    from->frequency_list[i].bucket = 0;
+    to->in_degree++;
+}
+
+/**
+ * Fill the frequency list of the row made of records[0 .. count - 1],
+ * in order of first occurrence.
+ */
+static int emit_row(ExternalRun *ext, PairRecord *records, size_t count) {
+    qsort(records, count, sizeof(PairRecord), compare_first);
+    MarkovNode *from = ext->nodes[records[0].from];
+    if (start_row(ext, from, count) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        set_successor(ext, from, i, &records[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int refill(RunReader *reader, size_t buf_records) {
+    size_t want = reader->remaining < buf_records ? reader->remaining
+                                                  : buf_records;
+    // Readers may share a file, so every refill seeks to its own records
+    if (fseek(reader->fp, reader->offset, SEEK_SET) != 0 ||
+        fread(reader->buf, sizeof(PairRecord), want, reader->fp) != want) {
+        printf("Error: Failed to read a run from a temporary file.\n");
+        return EXIT_FAILURE;
+    }
+    reader->offset += (long)(want * sizeof(PairRecord));
+    reader->len = want;
+    reader->pos = 0;
+    reader->remaining -= want;
+    return EXIT_SUCCESS;
+}
+
+typedef int (*record_order)(const void *a, const void *b);
+
+static int reader_less(const RunReader *readers, size_t a, size_t b,
+                       record_order order) {
+    return order(&readers[a].buf[readers[a].pos],
+                 &readers[b].buf[readers[b].pos]) < 0;
+}
+
+static void sift_down(size_t *heap, size_t size, const RunReader *readers,
+                      record_order order, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < size &&
+            reader_less(readers, heap[left], heap[smallest], order)) {
+            smallest = left;
+        }
+        if (right < size &&
+            reader_less(readers, heap[right], heap[smallest], order)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        size_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * Take the first record of the readers in heap into rec, refilling the
+ * reader it came from or dropping it once it is exhausted.
+ */
+static int pop_record(size_t *heap, size_t *heap_size, RunReader *readers,
+                      record_order order, size_t buf_records,
+                      PairRecord *rec) {
+    RunReader *top = &readers[heap[0]];
+    *rec = top->buf[top->pos++];
+    if (top->pos == top->len) {
+        if (top->remaining > 0) {
+            if (refill(top, buf_records) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            heap[0] = heap[--*heap_size];
+        }
+    }
+    sift_down(heap, *heap_size, readers, order, 0);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Sort ext->row[0 .. count - 1] by first occurrence and append it to
+ * ext->row_file as one more part of the row being written.
+ */
+static int spill_row_part(ExternalRun *ext, size_t count) {
+    if (!ext->row_file) {
+        ext->row_file = tmpfile();
+        if (!ext->row_file) {
+            printf("Error: Failed to create a temporary file.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    // Every row too long for the buffer reuses the file from its start
+    if (ext->row_spilled == 0 && fseek(ext->row_file, 0, SEEK_SET) != 0) {
+        printf("Error: Failed to rewind a temporary file.\n");
+        return EXIT_FAILURE;
+    }
+    qsort(ext->row, count, sizeof(PairRecord), compare_first);
+    if (write_records(ext, ext->row_file, ext->row, count) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    ext->row_spilled += count;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Fill the frequency list of a row spilled in parts, ext->row[0 .. count
+ * - 1] being its last one, by merging the parts on first occurrence. The
+ * parts share the row buffer, down to one record each.
+ */
+static int emit_spilled_row(ExternalRun *ext, size_t count) {
+    if (count > 0 && spill_row_part(ext, count) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    size_t total = ext->row_spilled;
+    size_t part = ext->row_capacity;  // every part but the last is full
+    size_t parts = (total + part - 1) / part;
+    size_t buf_records = part / parts;
+    PairRecord *bufs = ext->row;
+    PairRecord *extra = NULL;
+    if (buf_records == 0) {
+        buf_records = 1;
+        bufs = extra = malloc(parts * sizeof(PairRecord));
+    }
+    RunReader *readers = calloc(parts, sizeof(RunReader));
+    size_t *heap = malloc(parts * sizeof(size_t));
+    MarkovNode *from = ext->nodes[ext->row_from];
+    if (!bufs || !readers || !heap) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        free(extra);
+        free(readers);
+        free(heap);
+        return EXIT_FAILURE;
+    }
+    int result = start_row(ext, from, total);
+    size_t heap_size = 0;
+    for (size_t i = 0; result == EXIT_SUCCESS && i < parts; i++) {
+        readers[i].fp = ext->row_file;
+        readers[i].offset = (long)(i * part * sizeof(PairRecord));
+        readers[i].remaining = total - i * part < part ? total - i * part
+                                                       : part;
+        readers[i].buf = bufs + i * buf_records;
+        result = refill(&readers[i], buf_records);
+        heap[heap_size++] = i;
+    }
+    for (size_t i = heap_size / 2; result == EXIT_SUCCESS && i-- > 0;) {
+        sift_down(heap, heap_size, readers, compare_first, i);
+    }
+    for (size_t i = 0; result == EXIT_SUCCESS && heap_size > 0; i++) {
+        PairRecord rec;
+        result = pop_record(heap, &heap_size, readers, compare_first,
+                            buf_records, &rec);
+        set_successor(ext, from, i, &rec);
+    }
+    ext->row_spilled = 0;
+    ext->stats->split_rows++;
+    free(extra);
+    free(readers);
+    free(heap);
+    return result;
+}
+
+/**
+ * Consumer of the final, fully aggregated stream, ordered by (from, to):
+ * gathers the records of one row and emits it when the row changes. A row
+ * that outgrows ext->row is spilled in parts. Pass NULL to emit the last
+ * row.
+ */
+static int consume(ExternalRun *ext, const PairRecord *rec, size_t *row_len) {
+    bool in_row = *row_len > 0 || ext->row_spilled > 0;
+    if (in_row && (!rec || rec->from != ext->row_from)) {
+        int result = ext->row_spilled > 0
+                     ? emit_spilled_row(ext, *row_len)
+                     : emit_row(ext, ext->row, *row_len);
+        if (result != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        *row_len = 0;
+    }
+    if (!rec) {
+        return EXIT_SUCCESS;
+    }
+    if (*row_len == ext->row_capacity) {
+        if (spill_row_part(ext, *row_len) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        *row_len = 0;
+    }
+    ext->row_from = rec->from;
+    ext->row[(*row_len)++] = *rec;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * k-way merge of runs[0 .. count - 1], summing equal pairs. The merged
+ * stream goes to out as a new run, or to the row consumer if out is NULL.
+ * The merged runs are closed.
+ * @param merged receives the number of records written to out
+ */
+static int merge_runs(ExternalRun *ext, Run *runs, size_t count, FILE *out,
+                      size_t *merged) {
+    // Split the budget between the readers and one output buffer, plus the
+    // row buffer of the consumer
+    size_t buffers = count + (out ? 1 : 2);
+    size_t buf_records = ext->budget_bytes / (buffers * sizeof(PairRecord));
+    if (buf_records < 2) {
+        buf_records = 2;
+    }
+    RunReader *readers = calloc(count, sizeof(RunReader));
+    size_t *heap = malloc(count * sizeof(size_t));
+    PairRecord *pending = malloc(buf_records * sizeof(PairRecord));
+    int result = (readers && heap && pending) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (result == EXIT_SUCCESS && !out) {
+        free(ext->row);
+        ext->row = malloc(buf_records * sizeof(PairRecord));
+        ext->row_capacity = buf_records;
+        result = ext->row ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (result != EXIT_SUCCESS) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+    }
+
+    size_t heap_size = 0;
+    for (size_t i = 0; result == EXIT_SUCCESS && i < count; i++) {
+        readers[i].fp = runs[i].fp;
+        readers[i].remaining = runs[i].count;
+        readers[i].buf = malloc(buf_records * sizeof(PairRecord));
+        if (!readers[i].buf) {
+            printf(ALLOCATION_ERROR_MESSAGE);
+            result = EXIT_FAILURE;
+        } else if (refill(&readers[i], buf_records) != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        } else if (readers[i].len > 0) {
+            heap[heap_size++] = i;
+        }
+    }
+    for (size_t i = heap_size / 2; result == EXIT_SUCCESS && i-- > 0;) {
+        sift_down(heap, heap_size, readers, compare_pairs, i);
+    }
+
+    size_t pending_len = 0;
+    size_t row_len = 0;
+    *merged = 0;
+    while (result == EXIT_SUCCESS && heap_size > 0) {
+        PairRecord rec;
+        result = pop_record(heap, &heap_size, readers, compare_pairs,
+                            buf_records, &rec);
+        if (result != EXIT_SUCCESS) {
+            break;
+        }
+        if (pending_len > 0 && fold_pair(&pending[pending_len - 1], &rec)) {
+            continue;
+        }
+        if (pending_len == buf_records) {
+            // Keep the last record, a later one may still fold into it
+            size_t ready = pending_len - 1;
+            if (out) {
+                result = write_records(ext, out, pending, ready);
+                *merged += ready;
+            } else {
+                for (size_t i = 0; result == EXIT_SUCCESS && i < ready; i++) {
+                    result = consume(ext, &pending[i], &row_len);
+                }
+            }
+            pending[0] = pending[pending_len - 1];
+            pending_len = 1;
+        }
+        pending[pending_len++] = rec;
+    }
+    if (result == EXIT_SUCCESS) {
+        if (out) {
+            result = write_records(ext, out, pending, pending_len);
+            *merged += pending_len;
+        } else {
+            for (size_t i = 0; result == EXIT_SUCCESS && i < pending_len; i++) {
+                result = consume(ext, &pending[i], &row_len);
+            }
+            if (result == EXIT_SUCCESS) {
+                result = consume(ext, NULL, &row_len);
+            }
+        }
+    }
+
+    for (size_t i = 0; readers && i < count; i++) {
+        free(readers[i].buf);
+    }
+    for (size_t i = 0; i < count; i++) {
+        fclose(runs[i].fp);
+        runs[i].fp = NULL;
+    }
+    free(readers);
+    free(heap);
+    free(pending);
+    return result;
+}
+
+/**
+ * Merge groups of fan_in runs into longer runs until at most fan_in are
+ * left.
+ */
+static int reduce_runs(ExternalRun *ext, size_t fan_in) {
+    while (ext->num_runs > fan_in) {
+        size_t out_runs = 0;
+        for (size_t i = 0; i < ext->num_runs; i += fan_in) {
+            size_t group = ext->num_runs - i < fan_in ? ext->num_runs - i
+                                                      : fan_in;
+            FILE *out = tmpfile();
+            if (!out) {
+                printf("Error: Failed to create a temporary file.\n");
+                return EXIT_FAILURE;
+            }
+            size_t merged = 0;
+            if (merge_runs(ext, &ext->runs[i], group, out, &merged) !=
+                EXIT_SUCCESS) {
+                fclose(out);
+                return EXIT_FAILURE;
+            }
+            ext->runs[out_runs].fp = out;
+            ext->runs[out_runs].count = merged;
+            out_runs++;
+        }
+        ext->num_runs = out_runs;
+        ext->stats->merge_passes++;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Turn the collected pairs into frequency lists.
+ */
+static int build_frequency_lists(ExternalRun *ext) {
+    LinkedList *database = ext->markov_chain->database;
+    ext->nodes = malloc(((size_t)database->size + 1) * sizeof(MarkovNode *));
+    if (!ext->nodes) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    for (Node *cur = database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        ext->nodes[mnode->id] = mnode;
+    }
+
+    if (ext->num_runs == 0) {
+        // Everything fit in memory, and every row is a slice of the buffer
+        size_t count = sort_and_aggregate(ext->buffer, ext->used);
+        PairRecord *records = ext->buffer;
+        size_t end;
+        for (size_t begin = 0; begin < count; begin = end) {
+            for (end = begin + 1;
+                 end < count && records[end].from == records[begin].from;
+                 end++) {
+            }
+            if (emit_row(ext, records + begin, end - begin) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // The tail of the scan becomes the last run
+    if (ext->used > 0) {
+        size_t tail = sort_and_aggregate(ext->buffer, ext->used);
+        FILE *fp = tmpfile();
+        if (!fp) {
+            printf("Error: Failed to create a temporary file.\n");
+            return EXIT_FAILURE;
+        }
+        if (write_records(ext, fp, ext->buffer, tail) != EXIT_SUCCESS ||
+            push_run(ext, fp, tail) != EXIT_SUCCESS) {
+            fclose(fp);
+            return EXIT_FAILURE;
+        }
+        ext->stats->runs++;
+        ext->used = 0;
+    }
+    // The pair buffer is no longer needed, its memory goes to the merge
+    free(ext->buffer);
+    ext->buffer = NULL;
+
+    size_t fan_in = ext->budget_bytes / MIN_RUN_BUFFER_BYTES;
+    if (fan_in < 2) {
+        fan_in = 2;
+    }
+    if (reduce_runs(ext, fan_in) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    size_t merged = 0;
+    size_t runs = ext->num_runs;
+    ext->num_runs = 0;
+    return merge_runs(ext, ext->runs, runs, NULL, &merged);
+}
+
+int fill_database_external(CorpusReader *corpus, int words_to_read,
+                           MarkovChain *markov_chain, hash_func hash,
+                           size_t budget_bytes, ExternalStats *stats) {
+    if (!corpus || !markov_chain || !markov_chain->database || !hash ||
+        markov_chain->database->size != 0) {
+        return EXIT_FAILURE;
+    }
+    ExternalStats local;
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    ExternalRun ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.markov_chain = markov_chain;
+    ext.budget_bytes = budget_bytes;
+    ext.stats = stats;
+    ext.capacity = budget_bytes / sizeof(PairRecord);
+    if (ext.capacity < MIN_BUFFER_RECORDS) {
+        ext.capacity = MIN_BUFFER_RECORDS;
+    }
+    ext.buffer = malloc(ext.capacity * sizeof(PairRecord));
+    if (!ext.buffer) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+
+    double start = stopwatch_now();
+    int result = scan_corpus(&ext, corpus, words_to_read, hash);
+    double scanned = stopwatch_now();
+    stats->scan_seconds = scanned - start;
+    if (result == EXIT_SUCCESS) {
+        result = build_frequency_lists(&ext);
+    }
+    stats->merge_seconds = stopwatch_now() - scanned;
+
+    for (size_t i = 0; i < ext.num_runs; i++) {
+        if (ext.runs[i].fp) {
+            fclose(ext.runs[i].fp);
+        }
+    }
+    free(ext.runs);
+    free(ext.buffer);
+    if (ext.row_file) {
+        fclose(ext.row_file);
+    }
+    free(ext.nodes);
+    free(ext.row);
+    return result;
+}
+
+void print_external_stats(FILE *out, const ExternalStats *stats) {
+    if (!out || !stats) {
+        return;
+    }
+    fprintf(out, "External training: %llu pairs, %llu distinct\n",
+            stats->pairs, stats->distinct);
+    fprintf(out, "  spill: %zu runs, %.1f KB written, %zu merge passes, "
+                 "%zu rows split\n",
+            stats->runs, stats->spilled_bytes / 1024.0, stats->merge_passes,
+            stats->split_rows);
+    fprintf(out, "  scan %.3f s, merge %.3f s\n", stats->scan_seconds,
+            stats->merge_seconds);
+}
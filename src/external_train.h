@@ -0,0 +1,60 @@
+#ifndef _EXTERNAL_TRAIN_H
+#define _EXTERNAL_TRAIN_H
+
+#include "markov_chain.h"
+#include "corpus_reader.h"
+#include <stdio.h>
+
+// Pass as words_to_read to train on the whole input.
+#define EXTERNAL_READ_ALL (-1)
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+typedef struct ExternalStats {
+    unsigned long long pairs;       // bigrams read from the corpus
+    unsigned long long distinct;    // distinct bigrams in the model
+    size_t runs;                    // sorted runs spilled to disk
+    size_t merge_passes;            // intermediate passes over the runs
+    size_t split_rows;              // rows too long for their buffer
+    unsigned long long spilled_bytes;
+    double scan_seconds;
+    double merge_seconds;
+} ExternalStats;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Train markov_chain from corpus out of core. Words are interned into the
+ * chain as they are first seen (the vocabulary stays in memory), while
+ * (word id, next word id) pairs are collected in a buffer of budget_bytes.
+ * Whenever it fills, the buffer is sorted, duplicate pairs are summed and
+ * the result is spilled to a temporary file as a sorted run. The runs are
+ * then merged (in several passes if the budget cannot buffer all of them)
+ * and the counts are written into the frequency lists. The successors of
+ * a word are gathered in a share of the budget and ordered by first
+ * occurrence; a word with more of them is spilled in sorted parts, which
+ * are merged back into its frequency list.
+ *
+ * Frequency lists come out with the same counts, in the same order, as
+ * with the in-memory fill_database(), so sampling with the same seed gives
+ * the same tweets.
+ * @param hash hash function consistent with markov_chain->comp_func
+ * @param words_to_read maximum number of words, or EXTERNAL_READ_ALL
+ * @param budget_bytes memory for pair buffers, at least a few KB
+ * @param stats receives counters, may be NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int fill_database_external(CorpusReader *corpus, int words_to_read,
+                           MarkovChain *markov_chain, hash_func hash,
+                           size_t budget_bytes, ExternalStats *stats);
+
+/**
+ * Print spill and merge counters.
+ */
+void print_external_stats(FILE *out, const ExternalStats *stats);
+
+#endif /* _EXTERNAL_TRAIN_H */
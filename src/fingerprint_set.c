@@ -0,0 +1,61 @@
+#include "fingerprint_set.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Odd multiplier of the rolling hash
+#define ROLLING_BASE 0x100000001B3ULL
+
+int fingerprint_set_init(FingerprintSet *set, size_t expected) {
+    size_t capacity = 16;
+    while (capacity < expected * 2) {
+        capacity *= 2;
+    }
+    set->slots = calloc(capacity, sizeof(uint64_t));
+    set->mask = capacity - 1;
+    return set->slots ? 0 : 1;
+}
+
+void fingerprint_set_destroy(FingerprintSet *set) {
+    if (!set) {
+        return;
+    }
+    free(set->slots);
+    set->slots = NULL;
+    set->mask = 0;
+}
+
+int fingerprint_set_insert(FingerprintSet *set, uint64_t fingerprint) {
+    if (fingerprint == 0) {
+        fingerprint = 1; // 0 marks empty slots
+    }
+    size_t slot = (size_t)fingerprint & set->mask;
+    for (size_t probes = 0; probes <= set->mask; probes++) {
+        uint64_t seen = __atomic_load_n(&set->slots[slot], __ATOMIC_ACQUIRE);
+        if (seen == 0) {
+            if (__atomic_compare_exchange_n(&set->slots[slot], &seen,
+                                            fingerprint, false,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                return 1;
+            }
+            // Lost the race; seen now holds the winner's fingerprint
+        }
+        if (seen == fingerprint) {
+            return 0;
+        }
+        slot = (slot + 1) & set->mask;
+    }
+    return -1;
+}
+
+uint64_t fingerprint_tokens(const uint32_t *tokens, uint32_t length) {
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = hash * ROLLING_BASE + (uint64_t)tokens[i] + 1;
+    }
+    // splitmix64 finalizer
+    hash ^= length;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
@@ -0,0 +1,53 @@
+#ifndef _FINGERPRINT_SET_H
+#define _FINGERPRINT_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Set of 64-bit sequence fingerprints for duplicate rejection. Only the
+ * fingerprints are stored, 8 bytes per slot, never the sequences. Slots
+ * are claimed with compare-and-swap, so any number of threads may insert
+ * at once without a lock. The table does not grow: it is sized up front
+ * for the number of fingerprints it will hold.
+ *
+ * Two different sequences share a fingerprint with probability about
+ * 2^-64 per pair, in which case the second is taken for a duplicate.
+ */
+typedef struct FingerprintSet {
+    uint64_t *slots;  // 0 marks an empty slot
+    size_t mask;      // capacity - 1, capacity a power of two
+} FingerprintSet;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Initialize an empty set for up to expected fingerprints, at most half
+ * full.
+ * @return 0 on success, 1 on allocation failure
+ */
+int fingerprint_set_init(FingerprintSet *set, size_t expected);
+
+void fingerprint_set_destroy(FingerprintSet *set);
+
+/**
+ * Insert fingerprint. Safe to call from several threads at once.
+ * @return 1 if it was new, 0 if it was already present, -1 if the set is
+ *         full
+ */
+int fingerprint_set_insert(FingerprintSet *set, uint64_t fingerprint);
+
+/**
+ * Fingerprint of a sequence of token ids: a polynomial rolling hash,
+ * updated one token at a time, with the length and a final mix so that
+ * every bit depends on every token.
+ */
+uint64_t fingerprint_tokens(const uint32_t *tokens, uint32_t length);
+
+#endif /* _FINGERPRINT_SET_H */
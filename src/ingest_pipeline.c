@@ -0,0 +1,484 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ingest_pipeline.h"
+#include "spsc_queue.h"
+#include "node_index.h"
+#include "stopwatch.h"
+#include <pthread.h>
+#include <string.h>
+
+#define DELIMITERS " \n\t\r"
+#define LINE_MAX 1001
+#define BLOCK_BYTES (64 * 1024)
+#define QUEUE_DEPTH 8
+// Every queue can hold all blocks of its kind, so a free-list push never fails
+#define BLOCKS_PER_STAGE QUEUE_DEPTH
+#define BLOCK_NODES (BLOCK_BYTES / sizeof(MarkovNode *))
+#define INDEX_CAPACITY 1024
+
+/**
+ * A batch passed between stages. The reader packs NUL-terminated lines
+ * (exactly what fgets returned) into data.text. The tokenizer either packs
+ * the nodes of the words into data.nodes, with NULL marking the end of a
+ * line, or, with a memory budget, NUL-terminated tokens into data.text,
+ * with an empty string marking the end of a line.
+ */
+typedef struct IngestBlock {
+    size_t used;   // bytes of text in use
+    size_t count;  // lines, tokens or nodes stored
+    size_t bytes;  // length of the words stored as nodes
+    int eof;       // last block of the stream
+    union {
+        char text[BLOCK_BYTES];
+        MarkovNode *nodes[BLOCK_NODES];
+    } data;
+} IngestBlock;
+
+typedef struct Pipeline {
+    CorpusReader *corpus;
+    int stop;  // raised to abort the other stages
+    // Interning: the tokenizer resolves words to nodes, in input order
+    bool intern;
+    bool indexed;  // words is in use, by the tokenizer or the trainer
+    MarkovChain *markov_chain;
+    NodeIndex words;
+    int words_to_read;
+    SpscQueue lines;       // reader -> tokenizer
+    SpscQueue free_lines;  // tokenizer -> reader
+    SpscQueue tokens;      // tokenizer -> trainer
+    SpscQueue free_tokens; // trainer -> tokenizer
+    IngestBlock *blocks;
+    IngestStats *stats;
+} Pipeline;
+
+/**
+ * Reader stage: fill line blocks with corpus_reader_gets() output.
+ */
+static void *reader_stage(void *arg) {
+    Pipeline *pipe = arg;
+    double start = stopwatch_now();
+    IngestStageStats *st = &pipe->stats->reader;
+    char line[LINE_MAX];
+
+    IngestBlock *block = spsc_queue_pop_wait(&pipe->free_lines, &pipe->stop,
+                                             &st->stalls, &st->wait_seconds);
+    while (block) {
+        block->used = 0;
+        block->count = 0;
+        block->eof = 0;
+        // Leave room for one more full line, so lines never straddle blocks
+        while (block->used + LINE_MAX <= BLOCK_BYTES) {
+            if (!corpus_reader_gets(line, LINE_MAX, pipe->corpus)) {
+                block->eof = 1;
+                break;
+            }
+            size_t len = strlen(line) + 1;
+            memcpy(block->data.text + block->used, line, len);
+            block->used += len;
+            block->count++;
+            st->items++;
+            st->bytes += len - 1;
+        }
+        int eof = block->eof;
+        if (!spsc_queue_push_wait(&pipe->lines, block, &pipe->stop,
+                                  &st->stalls, &st->wait_seconds) || eof) {
+            break;
+        }
+        block = spsc_queue_pop_wait(&pipe->free_lines, &pipe->stop,
+                                    &st->stalls, &st->wait_seconds);
+    }
+    st->run_seconds = stopwatch_now() - start;
+    return NULL;
+}
+
+/**
+ * Hand out a fresh token block, or NULL if the pipeline was stopped.
+ */
+static IngestBlock *next_token_block(Pipeline *pipe) {
+    IngestStageStats *st = &pipe->stats->tokenizer;
+    IngestBlock *block = spsc_queue_pop_wait(&pipe->free_tokens, &pipe->stop,
+                                             &st->stalls, &st->wait_seconds);
+    if (block) {
+        block->used = 0;
+        block->count = 0;
+        block->bytes = 0;
+        block->eof = 0;
+    }
+    return block;
+}
+
+/**
+ * Send the full token block downstream and take a fresh one.
+ * @return 0 on success, 1 if the pipeline was stopped
+ */
+static int flush_token_block(Pipeline *pipe, IngestBlock **out) {
+    IngestStageStats *st = &pipe->stats->tokenizer;
+    if (!spsc_queue_push_wait(&pipe->tokens, *out, &pipe->stop,
+                              &st->stalls, &st->wait_seconds)) {
+        return 1;
+    }
+    *out = next_token_block(pipe);
+    return *out == NULL;
+}
+
+/**
+ * Append str (including its terminator) to the token block, sending the
+ * block downstream first if it is full.
+ * @return 0 on success, 1 if the pipeline was stopped
+ */
+static int emit_token(Pipeline *pipe, IngestBlock **out, const char *str) {
+    size_t len = strlen(str) + 1;
+    if ((*out)->used + len > BLOCK_BYTES && flush_token_block(pipe, out)) {
+        return 1;
+    }
+    memcpy((*out)->data.text + (*out)->used, str, len);
+    (*out)->used += len;
+    (*out)->count++;
+    return 0;
+}
+
+/**
+ * Append node (NULL for the end of a line) to the token block, sending the
+ * block downstream first if it is full.
+ * @return 0 on success, 1 if the pipeline was stopped
+ */
+static int emit_node(Pipeline *pipe, IngestBlock **out, MarkovNode *node,
+                     size_t len) {
+    if ((*out)->count == BLOCK_NODES && flush_token_block(pipe, out)) {
+        return 1;
+    }
+    (*out)->data.nodes[(*out)->count++] = node;
+    (*out)->bytes += len;
+    return 0;
+}
+
+/**
+ * Find the node of token, adding it to the chain if it is new. Only one
+ * stage, the tokenizer or else the trainer, interns while the pipeline
+ * runs.
+ * @return the node, or NULL on allocation failure
+ */
+static MarkovNode *intern_token(Pipeline *pipe, const char *token) {
+    const NodeIndexSlot *slot = node_index_find(&pipe->words, token);
+    if (slot) {
+        return slot->node;
+    }
+    Node *node = append_to_database(pipe->markov_chain, (void *)token);
+    if (!node) {
+        return NULL;
+    }
+    if (node_index_insert(&pipe->words, node->data, 0) != 0) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return NULL;
+    }
+    return node->data;
+}
+
+/**
+ * Tokenizer stage body: split each line into words, keeping line breaks.
+ * When interning, words are resolved to nodes here and the word limit is
+ * applied here, so no word the trainer would skip enters the chain.
+ */
+static void tokenize_all(Pipeline *pipe) {
+    IngestStageStats *st = &pipe->stats->tokenizer;
+    IngestBlock *out = next_token_block(pipe);
+    if (!out) {
+        return;
+    }
+
+    int words = 0;
+    int eof = 0;
+    while (!eof) {
+        IngestBlock *in = spsc_queue_pop_wait(&pipe->lines, &pipe->stop,
+                                              &st->stalls, &st->wait_seconds);
+        if (!in) {
+            return;
+        }
+        char *line = in->data.text;
+        for (size_t i = 0; i < in->count && !eof; i++) {
+            size_t len = strlen(line);
+            char *save = NULL;
+            char *token = strtok_r(line, DELIMITERS, &save);
+            while (token) {
+                size_t token_len = strlen(token);
+                if (pipe->intern) {
+                    if (pipe->words_to_read != INGEST_READ_ALL &&
+                        words >= pipe->words_to_read) {
+                        break;  // the rest of the line is not trained
+                    }
+                    MarkovNode *node = intern_token(pipe, token);
+                    if (!node) {
+                        __atomic_store_n(&pipe->stop, 1, __ATOMIC_RELEASE);
+                        return;
+                    }
+                    if (emit_node(pipe, &out, node, token_len)) {
+                        return;
+                    }
+                    words++;
+                } else if (emit_token(pipe, &out, token)) {
+                    return;
+                }
+                st->items++;
+                st->bytes += token_len;
+                token = strtok_r(NULL, DELIMITERS, &save);
+            }
+            if (pipe->intern ? emit_node(pipe, &out, NULL, 0)
+                             : emit_token(pipe, &out, "")) {
+                return;
+            }
+            // The sequential reader stops at the end of the last line
+            eof = pipe->intern && pipe->words_to_read != INGEST_READ_ALL &&
+                  words >= pipe->words_to_read;
+            line += len + 1;
+        }
+        eof = eof || in->eof;
+        // The reader owns as many free slots as there are line blocks
+        spsc_queue_push(&pipe->free_lines, in);
+    }
+    out->eof = 1;
+    spsc_queue_push_wait(&pipe->tokens, out, &pipe->stop,
+                         &st->stalls, &st->wait_seconds);
+}
+
+static void *tokenizer_stage(void *arg) {
+    Pipeline *pipe = arg;
+    double start = stopwatch_now();
+    tokenize_all(pipe);
+    pipe->stats->tokenizer.run_seconds = stopwatch_now() - start;
+    return NULL;
+}
+
+/**
+ * Trainer stage for interned input: only frequency lists are updated, the
+ * nodes were created by the tokenizer in input order.
+ */
+static int train_nodes(Pipeline *pipe, MarkovChain *markov_chain) {
+    IngestStageStats *st = &pipe->stats->trainer;
+    MarkovNode *prev = NULL;
+    int eof = 0;
+
+    while (!eof) {
+        IngestBlock *block = spsc_queue_pop_wait(&pipe->tokens, &pipe->stop,
+                                                 &st->stalls,
+                                                 &st->wait_seconds);
+        if (!block) {
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < block->count; i++) {
+            MarkovNode *current = block->data.nodes[i];
+            if (current == NULL) {
+                prev = NULL;  // end of line
+                continue;
+            }
+            if (prev != NULL && !markov_chain->is_last(prev->data) &&
+                add_node_to_frequency_list(prev, current) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+            prev = current;
+            st->items++;
+        }
+        st->bytes += block->bytes;
+        eof = block->eof;
+        spsc_queue_push(&pipe->free_tokens, block);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Index the words of the chain again after pruning freed some of them.
+ * @return 0 on success, 1 on allocation failure
+ */
+static int reindex_words(Pipeline *pipe) {
+    MarkovChain *markov_chain = pipe->markov_chain;
+    hash_func hash = pipe->words.hash;
+    node_index_destroy(&pipe->words);
+    if (node_index_init(&pipe->words, (size_t)markov_chain->database->size,
+                        hash, markov_chain->comp_func) != 0) {
+        return 1;
+    }
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        if (node_index_insert(&pipe->words, cur->data, 0) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Trainer stage, run on the calling thread: the same insertion sequence as
+ * fill_database(), so the chain comes out identical. Words are interned
+ * here, through the index when there is one.
+ */
+static int trainer_stage(Pipeline *pipe, int words_to_read,
+                         MarkovChain *markov_chain, TrainingBudget *budget) {
+    IngestStageStats *st = &pipe->stats->trainer;
+    MarkovNode *prev = NULL;
+    int words_processed = 0;
+    int eof = 0;
+
+    while (!eof) {
+        IngestBlock *block = spsc_queue_pop_wait(&pipe->tokens, &pipe->stop,
+                                                 &st->stalls,
+                                                 &st->wait_seconds);
+        if (!block) {
+            return EXIT_FAILURE;
+        }
+        const char *token = block->data.text;
+        for (size_t i = 0; i < block->count; i++) {
+            size_t len = strlen(token);
+            bool limit_reached = words_to_read != INGEST_READ_ALL &&
+                                 words_processed >= words_to_read;
+            if (len == 0) {
+                // End of line: the sequential reader resets prev here
+                prev = NULL;
+                size_t passes = budget ? budget->prune_passes : 0;
+                if (training_budget_enforce(budget, markov_chain)
+                    != EXIT_SUCCESS) {
+                    printf("Error: Memory budget too small for the "
+                           "vocabulary.\n");
+                    return EXIT_FAILURE;
+                }
+                if (pipe->indexed && budget && budget->prune_passes != passes
+                    && reindex_words(pipe) != 0) {
+                    printf(ALLOCATION_ERROR_MESSAGE);
+                    return EXIT_FAILURE;
+                }
+                if (limit_reached) {
+                    return EXIT_SUCCESS;
+                }
+            } else if (!limit_reached) {
+                int old_size = markov_chain->database->size;
+                MarkovNode *current;
+                if (pipe->indexed) {
+                    current = intern_token(pipe, token);
+                } else {
+                    Node *node = add_to_database(markov_chain, (void *)token);
+                    current = node ? node->data : NULL;
+                }
+                if (current == NULL) {
+                    return EXIT_FAILURE;
+                }
+                if (markov_chain->database->size != old_size) {
+                    training_budget_add_node(budget, current);
+                }
+                if (prev != NULL && !markov_chain->is_last(prev->data) &&
+                    training_budget_add_edge(budget, prev, current)
+                    != EXIT_SUCCESS) {
+                    return EXIT_FAILURE;
+                }
+                prev = current;
+                words_processed++;
+                st->items++;
+                st->bytes += len;
+            }
+            token += len + 1;
+        }
+        eof = block->eof;
+        spsc_queue_push(&pipe->free_tokens, block);
+    }
+    return EXIT_SUCCESS;
+}
+
+int fill_database_pipelined(CorpusReader *corpus, int words_to_read,
+                            MarkovChain *markov_chain, hash_func hash,
+                            TrainingBudget *budget, IngestStats *stats) {
+    if (corpus == NULL || markov_chain == NULL) {
+        return EXIT_FAILURE;
+    }
+    IngestStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    Pipeline pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.corpus = corpus;
+    pipe.stats = stats;
+    // Pruning frees nodes, which the tokenizer may still hand out, so with
+    // a budget the trainer interns instead
+    pipe.intern = hash != NULL && budget == NULL;
+    pipe.indexed = hash != NULL;
+    pipe.markov_chain = markov_chain;
+    pipe.words_to_read = words_to_read;
+    if (pipe.indexed && node_index_init(&pipe.words, INDEX_CAPACITY, hash,
+                                       markov_chain->comp_func) != 0) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    pipe.blocks = malloc(2 * BLOCKS_PER_STAGE * sizeof(IngestBlock));
+    if (!pipe.blocks) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        if (pipe.indexed) {
+            node_index_destroy(&pipe.words);
+        }
+        return EXIT_FAILURE;
+    }
+    if (spsc_queue_init(&pipe.lines, QUEUE_DEPTH) ||
+        spsc_queue_init(&pipe.free_lines, QUEUE_DEPTH) ||
+        spsc_queue_init(&pipe.tokens, QUEUE_DEPTH) ||
+        spsc_queue_init(&pipe.free_tokens, QUEUE_DEPTH)) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        spsc_queue_destroy(&pipe.lines);
+        spsc_queue_destroy(&pipe.free_lines);
+        spsc_queue_destroy(&pipe.tokens);
+        spsc_queue_destroy(&pipe.free_tokens);
+        free(pipe.blocks);
+        if (pipe.indexed) {
+            node_index_destroy(&pipe.words);
+        }
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < BLOCKS_PER_STAGE; i++) {
+        spsc_queue_push(&pipe.free_lines, &pipe.blocks[i]);
+        spsc_queue_push(&pipe.free_tokens, &pipe.blocks[BLOCKS_PER_STAGE + i]);
+    }
+
+    double start = stopwatch_now();
+    pthread_t reader, tokenizer;
+    int result = EXIT_FAILURE;
+    if (pthread_create(&reader, NULL, reader_stage, &pipe) == 0) {
+        if (pthread_create(&tokenizer, NULL, tokenizer_stage, &pipe) == 0) {
+            result = pipe.intern
+                     ? train_nodes(&pipe, markov_chain)
+                     : trainer_stage(&pipe, words_to_read, markov_chain,
+                                     budget);
+            stats->trainer.run_seconds = stopwatch_now() - start;
+            __atomic_store_n(&pipe.stop, 1, __ATOMIC_RELEASE);
+            pthread_join(tokenizer, NULL);
+        } else {
+            __atomic_store_n(&pipe.stop, 1, __ATOMIC_RELEASE);
+        }
+        pthread_join(reader, NULL);
+    }
+    stats->wall_seconds = stopwatch_now() - start;
+
+    spsc_queue_destroy(&pipe.lines);
+    spsc_queue_destroy(&pipe.free_lines);
+    spsc_queue_destroy(&pipe.tokens);
+    spsc_queue_destroy(&pipe.free_tokens);
+    free(pipe.blocks);
+    if (pipe.indexed) {
+        node_index_destroy(&pipe.words);
+    }
+    return result;
+}
+
+static void print_stage(FILE *out, const char *name, const char *unit,
+                        const IngestStageStats *st) {
+    double busy = st->run_seconds - st->wait_seconds;
+    double mb = (double)st->bytes / (1024.0 * 1024.0);
+    fprintf(out, "  %-9s %10llu %-6s %8.2f MB  %8.2f MB/s busy  "
+                 "%6llu stalls (%.3f s waiting)\n",
+            name, st->items, unit, mb, busy > 0 ? mb / busy : 0.0,
+            st->stalls, st->wait_seconds);
+}
+
+void print_ingest_stats(FILE *out, const IngestStats *stats) {
+    if (!out || !stats) {
+        return;
+    }
+    fprintf(out, "Ingestion pipeline: %.3f s wall\n", stats->wall_seconds);
+    print_stage(out, "reader", "lines", &stats->reader);
+    print_stage(out, "tokenizer", "tokens", &stats->tokenizer);
+    print_stage(out, "trainer", "tokens", &stats->trainer);
+}
@@ -0,0 +1,71 @@
+#ifndef _INGEST_PIPELINE_H
+#define _INGEST_PIPELINE_H
+
+#include "markov_chain.h"
+#include "training_budget.h"
+#include "corpus_reader.h"
+#include <stdio.h>
+
+// Pass as words_to_read to train on the whole input.
+#define INGEST_READ_ALL (-1)
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Counters for one stage of the ingestion pipeline.
+ * items is lines for the reader and tokens for the tokenizer and trainer.
+ */
+typedef struct IngestStageStats {
+    unsigned long long items;
+    unsigned long long bytes;
+    unsigned long long stalls;  // times the stage waited on a full/empty queue
+    double wait_seconds;        // time spent in those waits
+    double run_seconds;         // time from stage start to stage exit
+} IngestStageStats;
+
+typedef struct IngestStats {
+    IngestStageStats reader;
+    IngestStageStats tokenizer;
+    IngestStageStats trainer;
+    double wall_seconds;
+} IngestStats;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Train markov_chain from corpus using three overlapped stages: a reader
+ * thread (corpus_reader_gets), a tokenizer thread and the calling thread.
+ * The tokenizer splits lines with strtok_r and interns every word through
+ * a hash index, creating nodes in input order, so the calling thread only
+ * updates frequency lists. Stages exchange fixed-size blocks through
+ * bounded lock-free queues, and the resulting chain is identical to the
+ * one built by the sequential fill_database().
+ *
+ * With a memory budget, pruning may free nodes while the tokenizer runs,
+ * so words are interned by the calling thread instead, through the same
+ * hash index, rebuilt after every pruning.
+ * @param corpus opened corpus, read by the reader thread only
+ * @param words_to_read maximum number of words to train on, or
+ *        INGEST_READ_ALL
+ * @param markov_chain chain whose function pointers are already set
+ * @param hash hash function consistent with markov_chain->comp_func, or
+ *        NULL to intern on the calling thread with the linear lookup of
+ *        add_to_database()
+ * @param budget memory budget enforced between lines, may be NULL
+ * @param stats filled with per-stage counters, may be NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int fill_database_pipelined(CorpusReader *corpus, int words_to_read,
+                            MarkovChain *markov_chain, hash_func hash,
+                            TrainingBudget *budget, IngestStats *stats);
+
+/**
+ * Print per-stage throughput and queue stalls.
+ */
+void print_ingest_stats(FILE *out, const IngestStats *stats);
+
+#endif /* _INGEST_PIPELINE_H */
@@ -0,0 +1,572 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include "markov_chain.h"
+#include "node_index.h"
+#include "batch_generate.h"
+#include "chain_layout.h"
+#include "perf_counter.h"
+#include "byte_chain.h"
+#include "stopwatch.h"
+
+#define BASE_10 10
+#define DEFAULT_VOCABULARY 50000
+#define DEFAULT_EXPONENT 1.0
+// Default of set_successor_index_threshold()
+#define INDEX_THRESHOLD 16
+// Walk benchmark: models of num_words / 4^k words, for k < WALK_SCALES
+#define WALK_SCALES 4
+#define WALK_LANES 16
+#define WALK_LENGTH 20
+#define WALK_SEQUENCES 1024
+#define WALK_TOKENS 2000000
+
+#define TEXT_LINE_WORDS 16
+#define BYTE_CHUNK 65536
+#define BYTE_GENERATE (64u << 20)
+#define BYTE_LANES 8
+
+#define USAGE "Usage: markov_bench <seed> <num_words> [vocabulary] [exponent]" \
+              " [--walks | --bytes]"
+
+/**
+ * Training benchmark on a synthetic corpus of integer tokens whose ranks
+ * follow a Zipf law, as words of natural text do. A few hub tokens then
+ * have thousands of distinct successors, which is where the successor
+ * index of add_node_to_frequency_list() matters.
+ */
+
+void *copy_token(const void *data) {
+    unsigned int *copy = malloc(sizeof(unsigned int));
+    if (!copy) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return NULL;
+    }
+    *copy = *(const unsigned int *)data;
+    return copy;
+}
+
+int compare_tokens(const void *data1, const void *data2) {
+    unsigned int a = *(const unsigned int *)data1;
+    unsigned int b = *(const unsigned int *)data2;
+    return (a > b) - (a < b);
+}
+
+size_t hash_token(const void *data) {
+    uint64_t key = *(const unsigned int *)data;
+    return (size_t)((key + 1) * 0x9E3779B97F4A7C15ULL >> 16);
+}
+
+void print_token(const void *data) {
+    printf("%u ", *(const unsigned int *)data);
+}
+
+void free_token(void *data) {
+    free(data);
+}
+
+// The corpus is one endless sequence
+bool is_last_token(const void *data) {
+    (void)data;
+    return false;
+}
+
+/**
+ * Draw num_words tokens with P(rank k) proportional to 1 / k^exponent.
+ * @return the tokens, or NULL on allocation failure
+ */
+unsigned int *zipf_corpus(uint64_t seed, size_t num_words,
+                          unsigned int vocabulary, double exponent) {
+    double *cumulative = malloc(vocabulary * sizeof(double));
+    unsigned int *tokens = malloc((num_words ? num_words : 1) *
+                                  sizeof(unsigned int));
+    if (!cumulative || !tokens) {
+        free(cumulative);
+        free(tokens);
+        return NULL;
+    }
+    double total = 0;
+    for (unsigned int k = 0; k < vocabulary; k++) {
+        total += 1.0 / pow(k + 1.0, exponent);
+        cumulative[k] = total;
+    }
+    MarkovRng rng;
+    markov_rng_seed(&rng, seed);
+    for (size_t i = 0; i < num_words; i++) {
+        // 53 random bits scaled to [0, total)
+        double u = (double)markov_rng_below(&rng, 1ULL << 53) /
+                   (double)(1ULL << 53) * total;
+        unsigned int lo = 0, hi = vocabulary - 1;
+        while (lo < hi) {
+            unsigned int mid = lo + (hi - lo) / 2;
+            if (cumulative[mid] <= u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        tokens[i] = lo;
+    }
+    free(cumulative);
+    return tokens;
+}
+
+MarkovChain *new_token_chain(void) {
+    MarkovChain *markov_chain = malloc(sizeof(MarkovChain));
+    if (!markov_chain) {
+        return NULL;
+    }
+    markov_chain->database = malloc(sizeof(LinkedList));
+    if (!markov_chain->database) {
+        free(markov_chain);
+        return NULL;
+    }
+    markov_chain->database->first = NULL;
+    markov_chain->database->last = NULL;
+    markov_chain->database->size = 0;
+    markov_chain->print_func = print_token;
+    markov_chain->comp_func = compare_tokens;
+    markov_chain->copy_func = copy_token;
+    markov_chain->free_data = free_token;
+    markov_chain->is_last = is_last_token;
+    return markov_chain;
+}
+
+/**
+ * Train a new chain on tokens, looking words up through a NodeIndex so
+ * the time goes to the frequency lists.
+ * @param seconds receives the training time
+ * @return the chain, or NULL on failure
+ */
+MarkovChain *train_tokens(const unsigned int *tokens, size_t num_words,
+                          double *seconds) {
+    MarkovChain *markov_chain = new_token_chain();
+    NodeIndex index;
+    if (!markov_chain ||
+        node_index_init(&index, 1024, hash_token, compare_tokens) != 0) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        free_database(&markov_chain);
+        return NULL;
+    }
+    double start = stopwatch_now();
+    MarkovNode *prev = NULL;
+    for (size_t i = 0; i < num_words; i++) {
+        MarkovNode *current;
+        const NodeIndexSlot *slot = node_index_find(&index, &tokens[i]);
+        if (slot) {
+            current = slot->node;
+        } else {
+            Node *node = append_to_database(markov_chain,
+                                            (void *)&tokens[i]);
+            if (!node || node_index_insert(&index, node->data, 0) != 0) {
+                node_index_destroy(&index);
+                free_database(&markov_chain);
+                return NULL;
+            }
+            current = node->data;
+        }
+        if (prev && add_node_to_frequency_list(prev, current)
+                    != EXIT_SUCCESS) {
+            node_index_destroy(&index);
+            free_database(&markov_chain);
+            return NULL;
+        }
+        prev = current;
+    }
+    *seconds = stopwatch_now() - start;
+    node_index_destroy(&index);
+    return markov_chain;
+}
+
+/**
+ * @return true if both chains have the same nodes and frequency lists
+ */
+bool same_chains(const MarkovChain *a, const MarkovChain *b) {
+    Node *x = a->database->first;
+    Node *y = b->database->first;
+    for (; x && y; x = x->next, y = y->next) {
+        MarkovNode *mx = x->data;
+        MarkovNode *my = y->data;
+        if (compare_tokens(mx->data, my->data) != 0 ||
+            mx->freq_size != my->freq_size) {
+            return false;
+        }
+        for (size_t i = 0; i < mx->freq_size; i++) {
+            if (mx->frequency_list[i].frequency !=
+                    my->frequency_list[i].frequency ||
+                mx->frequency_list[i].markov_node->id !=
+                    my->frequency_list[i].markov_node->id) {
+                return false;
+            }
+        }
+    }
+    return !x && !y;
+}
+
+void print_degrees(const MarkovChain *markov_chain) {
+    size_t max_degree = 0, indexed = 0, edges = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        edges += mnode->freq_size;
+        indexed += mnode->successor_index != NULL;
+        if (mnode->freq_size > max_degree) {
+            max_degree = mnode->freq_size;
+        }
+    }
+    printf("%d words, %zu distinct transitions, max degree %zu, "
+           "%zu nodes indexed\n", markov_chain->database->size, edges,
+           max_degree, indexed);
+}
+
+/**
+ * @return bytes of the nodes and frequency lists of markov_chain
+ */
+size_t model_bytes(const MarkovChain *markov_chain) {
+    size_t bytes = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        bytes += sizeof(Node) + sizeof(MarkovNode) + sizeof(unsigned int) +
+                 mnode->freq_capacity * sizeof(MarkovNodeFrequency) +
+                 successor_index_bytes(mnode);
+    }
+    return bytes;
+}
+
+/**
+ * Generate WALK_TOKENS words in batches, one walk at a time if lanes is 0.
+ * @param misses receives cache misses per word, -1 if they are not counted
+ * @return words generated per second
+ */
+double walk_rate(const GenerationTable *table, uint64_t seed, int lanes,
+                 SequenceBatch *batch, PerfCounter *counter, double *misses) {
+    MarkovRng rng;
+    markov_rng_seed(&rng, seed);
+    size_t words = 0;
+    perf_counter_start(counter);
+    double start = stopwatch_now();
+    while (words < WALK_TOKENS) {
+        if (lanes > 0) {
+            generate_batch_interleaved(table, &rng, WALK_SEQUENCES,
+                                       WALK_LENGTH, lanes, batch);
+        } else {
+            generate_batch(table, &rng, WALK_SEQUENCES, WALK_LENGTH, batch);
+        }
+        words += batch->used;
+    }
+    double seconds = stopwatch_now() - start;
+    long long count = perf_counter_stop(counter);
+    *misses = count >= 0 ? (double)count / words : -1.0;
+    return seconds > 0 ? words / seconds : 0.0;
+}
+
+void print_misses(double misses) {
+    if (misses >= 0) {
+        printf(" %8.2f", misses);
+    } else {
+        printf(" %8s", "-");
+    }
+}
+
+/**
+ * Measure single and interleaved walks on markov_chain.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the table cannot be built
+ */
+int measure_walks(MarkovChain *markov_chain, const char *layout,
+                  uint64_t seed, SequenceBatch *batch, PerfCounter *counter) {
+    GenerationTable table;
+    if (generation_table_build(&table, markov_chain, NULL) != 0) {
+        return EXIT_FAILURE;
+    }
+    double single_misses, interleaved_misses;
+    double single = walk_rate(&table, seed, 0, batch, counter,
+                              &single_misses);
+    double interleaved = walk_rate(&table, seed, WALK_LANES, batch, counter,
+                                   &interleaved_misses);
+    printf("  %-10s %12.0f", layout, single);
+    print_misses(single_misses);
+    printf(" %12.0f", interleaved);
+    print_misses(interleaved_misses);
+    printf(" %7.2fx\n", single > 0 ? interleaved / single : 0.0);
+    generation_table_free(&table);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Compare single and interleaved walks on models of growing size, as
+ * trained and after each layout pass.
+ */
+int walk_benchmark(const unsigned int *tokens, size_t num_words) {
+    uint32_t tokens_out[WALK_SEQUENCES * WALK_LENGTH];
+    size_t offsets[WALK_SEQUENCES];
+    uint32_t lengths[WALK_SEQUENCES];
+    SequenceBatch batch = {tokens_out, WALK_SEQUENCES * WALK_LENGTH, offsets,
+                           lengths, WALK_SEQUENCES, 0, 0};
+    PerfCounter counter;
+    if (perf_counter_open(&counter) != 0) {
+        printf("Cache misses cannot be counted here\n");
+    }
+    printf("  %-10s %12s %8s %12s %8s %8s\n", "layout", "single w/s",
+           "miss/w", "interleaved", "miss/w", "speedup");
+    int result = EXIT_SUCCESS;
+    for (int k = WALK_SCALES - 1; k >= 0 && result == EXIT_SUCCESS; k--) {
+        size_t words = num_words >> (2 * k);
+        if (words < 2) {
+            continue;
+        }
+        double seconds;
+        MarkovChain *markov_chain = train_tokens(tokens, words, &seconds);
+        if (!markov_chain) {
+            printf("Error: Training failed.\n");
+            result = EXIT_FAILURE;
+            break;
+        }
+        printf("%zu words, %.1f MB:\n", words,
+               model_bytes(markov_chain) / 1048576.0);
+        LayoutStats stats;
+        if (measure_walks(markov_chain, "trained", words, &batch,
+                          &counter) != EXIT_SUCCESS ||
+            optimize_chain_layout(markov_chain, LAYOUT_DFS, &stats)
+                != EXIT_SUCCESS ||
+            measure_walks(markov_chain, "dfs", words, &batch,
+                          &counter) != EXIT_SUCCESS ||
+            optimize_chain_layout(markov_chain, LAYOUT_STATIONARY, &stats)
+                != EXIT_SUCCESS ||
+            measure_walks(markov_chain, "stationary", words, &batch,
+                          &counter) != EXIT_SUCCESS) {
+            printf(ALLOCATION_ERROR_MESSAGE);
+            result = EXIT_FAILURE;
+        }
+        free_database(&markov_chain);
+    }
+    perf_counter_close(&counter);
+    return result;
+}
+
+/**
+ * Spell tokens as lowercase words, TEXT_LINE_WORDS to a line, for the byte
+ * chains. Frequent tokens get the short words.
+ * @param length receives the length of the text
+ * @return the text, or NULL on allocation failure
+ */
+unsigned char *render_text(const unsigned int *tokens, size_t num_words,
+                           size_t *length) {
+    // At most 7 letters for a 32-bit token, and a separator
+    unsigned char *text = malloc(num_words * 8 + 1);
+    if (!text) {
+        return NULL;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < num_words; i++) {
+        unsigned int token = tokens[i];
+        do {
+            text[used++] = (unsigned char)('a' + token % 26);
+            token /= 26;
+        } while (token > 0);
+        text[used++] = (i + 1) % TEXT_LINE_WORDS == 0 ? '\n' : ' ';
+    }
+    *length = used;
+    return text;
+}
+
+/**
+ * Generate like byte_chain_generate(), but by scanning the counts of the
+ * row until the draw is reached, as the word chain scans its lists.
+ */
+size_t linear_byte_walk(const ByteChain *chain, MarkovRng *rng,
+                        uint32_t *context, unsigned char *out,
+                        size_t length) {
+    uint32_t current = *context;
+    size_t written = 0;
+    while (written < length) {
+        uint32_t row = chain->row_of[current];
+        if (row == 0) {
+            current = chain->start_context;
+            continue;
+        }
+        const uint32_t *counts = chain->counts +
+                                 (size_t)(row - 1) * BYTE_ALPHABET;
+        uint64_t r = markov_rng_below(rng, chain->totals[row - 1]);
+        uint64_t cumulative = 0;
+        int byte = 0;
+        for (; byte < BYTE_ALPHABET - 1; byte++) {
+            cumulative += counts[byte];
+            if (cumulative > r) {
+                break;
+            }
+        }
+        out[written++] = (unsigned char)byte;
+        current = byte == BYTE_CHAIN_DELIMITER
+                  ? chain->start_context
+                  : ((current << 8) | (uint32_t)byte) & chain->context_mask;
+    }
+    *context = current;
+    return written;
+}
+
+/**
+ * Generate BYTE_GENERATE bytes from chain in chunks, by a linear scan of
+ * the counts if lanes is 0, else from the cumulative rows with lanes walks.
+ * @return bytes generated per second
+ */
+double byte_rate(const ByteChain *chain, uint64_t seed, int lanes) {
+    static unsigned char out[BYTE_CHUNK];
+    MarkovRng rngs[BYTE_LANES];
+    uint32_t contexts[BYTE_LANES];
+    for (int l = 0; l < BYTE_LANES; l++) {
+        markov_rng_seed(&rngs[l], seed + l);
+        contexts[l] = chain->start_context;
+    }
+    size_t generated = 0;
+    double start = stopwatch_now();
+    while (generated < BYTE_GENERATE) {
+        size_t written;
+        if (lanes == 0) {
+            written = linear_byte_walk(chain, rngs, contexts, out,
+                                       BYTE_CHUNK);
+        } else if (lanes == 1) {
+            written = byte_chain_generate(chain, rngs, contexts, out,
+                                          BYTE_CHUNK, false);
+        } else {
+            written = byte_chain_generate_lanes(chain, rngs, contexts, lanes,
+                                                out, BYTE_CHUNK);
+        }
+        if (written == 0) {
+            break;
+        }
+        generated += written;
+    }
+    double seconds = stopwatch_now() - start;
+    return seconds > 0 ? generated / seconds : 0.0;
+}
+
+/**
+ * Train byte chains of every order on the corpus spelled out as text and
+ * compare sampling from cumulative rows, one walk at a time and
+ * interleaved, with a linear scan of the counts.
+ */
+int byte_benchmark(const unsigned int *tokens, size_t num_words,
+                   uint64_t seed) {
+    size_t length;
+    unsigned char *text = render_text(tokens, num_words, &length);
+    if (!text) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    printf("%.1f MB of text\n", length / 1048576.0);
+    printf("  %-5s %9s %9s %11s %11s %11s %11s %8s\n", "order", "contexts",
+           "MB", "train MB/s", "linear", "rows", "interleaved", "speedup");
+    int result = EXIT_SUCCESS;
+    for (int order = 1; order <= BYTE_CHAIN_MAX_ORDER; order++) {
+        ByteChain chain;
+        if (byte_chain_init(&chain, order) != EXIT_SUCCESS ||
+            byte_chain_train(&chain, text, length) != EXIT_SUCCESS ||
+            byte_chain_finalize(&chain) != EXIT_SUCCESS) {
+            printf("Error: Training failed.\n");
+            byte_chain_destroy(&chain);
+            result = EXIT_FAILURE;
+            break;
+        }
+        double train = chain.stats.train_seconds > 0
+                       ? length / chain.stats.train_seconds : 0.0;
+        double linear = byte_rate(&chain, seed, 0);
+        double rows = byte_rate(&chain, seed, 1);
+        double interleaved = byte_rate(&chain, seed, BYTE_LANES);
+        printf("  %-5d %9zu %9.1f %11.1f %11.1f %11.1f %11.1f %7.2fx\n",
+               order, chain.stats.rows, chain.stats.model_bytes / 1048576.0,
+               train / 1048576.0, linear / 1048576.0, rows / 1048576.0,
+               interleaved / 1048576.0,
+               linear > 0 ? interleaved / linear : 0.0);
+        byte_chain_destroy(&chain);
+    }
+    free(text);
+    return result;
+}
+
+bool parse_number(const char *str, double *value) {
+    char *endptr;
+    errno = 0;
+    *value = strtod(str, &endptr);
+    if (errno == ERANGE || *endptr != '\0' || *value <= 0) {
+        printf("Error: Invalid number '%s'.\n", str);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool walks = argc > 1 && strcmp(argv[argc - 1], "--walks") == 0;
+    bool bytes = argc > 1 && strcmp(argv[argc - 1], "--bytes") == 0;
+    if (walks || bytes) {
+        argc--;
+    }
+    if (argc < 3 || argc > 5) {
+        printf("%s\n", USAGE);
+        return EXIT_FAILURE;
+    }
+    double words, vocabulary = DEFAULT_VOCABULARY;
+    double exponent = DEFAULT_EXPONENT;
+    if (!parse_number(argv[2], &words) ||
+        (argc > 3 && !parse_number(argv[3], &vocabulary)) ||
+        (argc > 4 && !parse_number(argv[4], &exponent))) {
+        return EXIT_FAILURE;
+    }
+    if (words < 1 || vocabulary < 1 || vocabulary > UINT32_MAX) {
+        printf("%s\n", USAGE);
+        return EXIT_FAILURE;
+    }
+    char *endptr;
+    errno = 0;
+    unsigned long seed = strtoul(argv[1], &endptr, BASE_10);
+    if (errno == ERANGE || *endptr != '\0') {
+        printf("%s\n", USAGE);
+        return EXIT_FAILURE;
+    }
+
+    size_t num_words = (size_t)words;
+    unsigned int *tokens = zipf_corpus(seed, num_words,
+                                       (unsigned int)vocabulary, exponent);
+    if (!tokens) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return EXIT_FAILURE;
+    }
+    printf("Zipf corpus: %zu words, vocabulary %u, exponent %.2f\n",
+           num_words, (unsigned int)vocabulary, exponent);
+    if (walks) {
+        set_successor_index_threshold(INDEX_THRESHOLD);
+        int result = walk_benchmark(tokens, num_words);
+        free(tokens);
+        return result;
+    }
+    if (bytes) {
+        int result = byte_benchmark(tokens, num_words, seed);
+        free(tokens);
+        return result;
+    }
+
+    double linear_seconds, indexed_seconds;
+    set_successor_index_threshold(0);
+    MarkovChain *linear = train_tokens(tokens, num_words, &linear_seconds);
+    set_successor_index_threshold(INDEX_THRESHOLD);
+    MarkovChain *indexed = train_tokens(tokens, num_words, &indexed_seconds);
+    free(tokens);
+    if (!linear || !indexed) {
+        printf("Error: Training failed.\n");
+        free_database(&linear);
+        free_database(&indexed);
+        return EXIT_FAILURE;
+    }
+
+    print_degrees(indexed);
+    printf("linear scan:     %8.3f s  %12.0f words/s\n", linear_seconds,
+           linear_seconds > 0 ? num_words / linear_seconds : 0.0);
+    printf("successor index: %8.3f s  %12.0f words/s  (%.2fx)\n",
+           indexed_seconds,
+           indexed_seconds > 0 ? num_words / indexed_seconds : 0.0,
+           indexed_seconds > 0 ? linear_seconds / indexed_seconds : 0.0);
+    bool same = same_chains(linear, indexed);
+    printf("frequency lists %s\n", same ? "identical" : "DIFFER");
+    free_database(&linear);
+    free_database(&indexed);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,6 +3,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+// Frequency lists with this many successors get a successor index
+#define SUCCESSOR_INDEX_THRESHOLD 16
+
+/**
+ * Hash set of the successors of one high-degree node: every slot holds a
+ * position in the node's frequency_list plus one, or 0 when empty. It has
+ * at least twice as many slots as the list has capacity, so it is never
+ * more than half full.
+ */
+struct SuccessorIndex {
+    size_t mask;  // number of slots - 1
+    uint32_t slots[];
+};
+
+static size_t successor_index_threshold = SUCCESSOR_INDEX_THRESHOLD;
+
 /**
  * Returns the node that wraps data_ptr if it exists in database;
  * otherwise returns NULL.
@@ -45,6 +61,19 @@ Node *add_to_database(MarkovChain *markov_chain, void *data_ptr) {
     }
 
     // Not found => create a new Node
+    return append_to_database(markov_chain, data_ptr);
+}
+
+/**
+ * Create a node for data_ptr at the end of the database, without looking
+ * for an existing one.
+ */
+Node *append_to_database(MarkovChain *markov_chain, void *data_ptr) {
+    if (!markov_chain || !markov_chain->database) {
+        return NULL;
+    }
+    LinkedList *database = markov_chain->database;
+
     Node *new_node = malloc(sizeof(Node));
     if (!new_node) {
         printf("Memory allocation failed in add_to_database()\n");
@@ -69,6 +98,9 @@ Node *add_to_database(MarkovChain *markov_chain, void *data_ptr) {
     mnode->frequency_list = NULL;
     mnode->freq_size = 0;
     mnode->freq_capacity = 0;
+    mnode->in_degree = 0;
+    mnode->successor_index = NULL;
+    mnode->id = (size_t)database->size;
 
     // Link MarkovNode to Node
     new_node->data = mnode;
@@ -82,6 +114,7 @@ Node *add_to_database(MarkovChain *markov_chain, void *data_ptr) {
         database->last->next = new_node;
         database->last = new_node;
     }
+    database->size++;
 
     return new_node;
 }
@@ -96,9 +129,89 @@ int add_node_to_freqlist_helper(MarkovChain *markov_chain, Node *firstnode) {
     return 1; // Non-terminal node
 }
 
+void set_successor_index_threshold(size_t threshold) {
+    successor_index_threshold = threshold;
+}
+
+static size_t successor_slot(const MarkovNode *successor, size_t mask) {
+    uint64_t key = (uint64_t)(uintptr_t)successor;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static void index_successor(struct SuccessorIndex *index,
+                            const MarkovNode *successor, size_t position) {
+    size_t slot = successor_slot(successor, index->mask);
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot] = (uint32_t)(position + 1);
+}
+
+/**
+ * Index the successors of node, sized for its current capacity. Without
+ * memory for it the node simply keeps using the linear scan.
+ */
+static void build_successor_index(MarkovNode *node) {
+    drop_successor_index(node);
+    size_t slots = 1;
+    while (slots < 2 * node->freq_capacity) {
+        slots <<= 1;
+    }
+    struct SuccessorIndex *index = calloc(1, sizeof(struct SuccessorIndex) +
+                                             slots * sizeof(uint32_t));
+    if (!index) {
+        return;
+    }
+    index->mask = slots - 1;
+    for (size_t i = 0; i < node->freq_size; i++) {
+        index_successor(index, node->frequency_list[i].markov_node, i);
+    }
+    node->successor_index = index;
+}
+
+void drop_successor_index(MarkovNode *node) {
+    free(node->successor_index);
+    node->successor_index = NULL;
+}
+
+size_t successor_index_bytes(const MarkovNode *node) {
+    if (!node->successor_index) {
+        return 0;
+    }
+    return sizeof(struct SuccessorIndex) +
+           (node->successor_index->mask + 1) * sizeof(uint32_t);
+}
+
+/**
+ * Position of successor in node->frequency_list, or freq_size if absent.
+ */
+static size_t find_successor(const MarkovNode *node,
+                             const MarkovNode *successor) {
+    const struct SuccessorIndex *index = node->successor_index;
+    if (!index) {
+        for (size_t i = 0; i < node->freq_size; i++) {
+            if (node->frequency_list[i].markov_node == successor) {
+                return i;
+            }
+        }
+        return node->freq_size;
+    }
+    size_t slot = successor_slot(successor, index->mask);
+    while (index->slots[slot] != 0) {
+        size_t position = index->slots[slot] - 1;
+        if (node->frequency_list[position].markov_node == successor) {
+            return position;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return node->freq_size;
+}
+
 /**
  * Add second_node to the frequency list of first_node.
  * If it already exists, increment frequency; else expand the array if needed.
+ * Nodes with many successors find them through a successor index instead
+ * of scanning the list.
  */
 int add_node_to_frequency_list(MarkovNode *first_node, MarkovNode *second_node) {
     if (!first_node || !second_node || !first_node->data || !second_node->data) {
@@ -116,13 +229,17 @@ int add_node_to_frequency_list(MarkovNode *first_node, MarkovNode *second_node)
             return EXIT_FAILURE;
         }
     }
+    bool wants_index = successor_index_threshold > 0 &&
+                       first_node->freq_size >= successor_index_threshold;
+    if (wants_index && !first_node->successor_index) {
+        build_successor_index(first_node);
+    }
 
     // Check if second_node is already in the frequency_list
-    for (size_t i = 0; i < first_node->freq_size; i++) {
-        if (first_node->frequency_list[i].markov_node == second_node) {
-            first_node->frequency_list[i].frequency++;
-            return EXIT_SUCCESS;
-        }
+    size_t position = find_successor(first_node, second_node);
+    if (position < first_node->freq_size) {
+        first_node->frequency_list[position].frequency++;
+        return EXIT_SUCCESS;
     }
 
     // Not found => need to insert
@@ -138,16 +255,173 @@ int add_node_to_frequency_list(MarkovNode *first_node, MarkovNode *second_node)
         }
         first_node->frequency_list = new_list;
         first_node->freq_capacity  = new_capacity;
+        if (first_node->successor_index) {
+            build_successor_index(first_node); // resize with the list
+        }
     }
 
     // Insert at freq_size
     first_node->frequency_list[first_node->freq_size].markov_node = second_node;
     first_node->frequency_list[first_node->freq_size].frequency   = 1;
+    first_node->frequency_list[first_node->freq_size].bucket      = 0;
+    if (first_node->successor_index) {
+        index_successor(first_node->successor_index, second_node,
+                        first_node->freq_size);
+    }
     first_node->freq_size++;
+    second_node->in_degree++;
 
     return EXIT_SUCCESS;
 }
 
+/**
+ * Slot of the index of node that holds position, which must be indexed.
+ */
+static size_t slot_of_position(const MarkovNode *node, size_t position) {
+    const struct SuccessorIndex *index = node->successor_index;
+    size_t slot = successor_slot(node->frequency_list[position].markov_node,
+                                 index->mask);
+    while (index->slots[slot] != position + 1) {
+        slot = (slot + 1) & index->mask;
+    }
+    return slot;
+}
+
+/**
+ * Empty slot and move later entries of its probe run back into the hole,
+ * so that lookups never stop early (deletion without tombstones).
+ */
+static void unindex_slot(MarkovNode *node, size_t slot) {
+    struct SuccessorIndex *index = node->successor_index;
+    size_t mask = index->mask;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; index->slots[next] != 0;
+         next = (next + 1) & mask) {
+        const MarkovNode *successor =
+            node->frequency_list[index->slots[next] - 1].markov_node;
+        size_t home = successor_slot(successor, mask);
+        // The entry may fill the hole unless its home lies after the hole
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+    }
+    index->slots[hole] = 0;
+}
+
+/**
+ * Decrement the frequency of second_node in the list of first_node. An
+ * entry that drops to zero is replaced by the last one of the list.
+ */
+int remove_node_from_frequency_list(MarkovNode *first_node,
+                                    MarkovNode *second_node) {
+    if (!first_node || !second_node) {
+        return EXIT_FAILURE;
+    }
+    size_t position = find_successor(first_node, second_node);
+    if (position == first_node->freq_size) {
+        return EXIT_FAILURE;
+    }
+    if (--first_node->frequency_list[position].frequency > 0) {
+        return EXIT_SUCCESS;
+    }
+    size_t last = first_node->freq_size - 1;
+    if (first_node->successor_index) {
+        unindex_slot(first_node, slot_of_position(first_node, position));
+        if (position != last) {
+            size_t moved = slot_of_position(first_node, last);
+            first_node->successor_index->slots[moved] =
+                (uint32_t)position + 1;
+        }
+    }
+    first_node->frequency_list[position] = first_node->frequency_list[last];
+    first_node->freq_size--;
+    second_node->in_degree--;
+    return EXIT_SUCCESS;
+}
+
+static int compare_frequency_desc(const void *a, const void *b) {
+    int fa = ((const MarkovNodeFrequency *)a)->frequency;
+    int fb = ((const MarkovNodeFrequency *)b)->frequency;
+    return (fa < fb) - (fa > fb);
+}
+
+/**
+ * Sort every frequency list by descending frequency.
+ */
+void sort_frequency_lists(MarkovChain *markov_chain) {
+    if (!markov_chain || !markov_chain->database) {
+        return;
+    }
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        if (mnode->freq_size > 1) {
+            qsort(mnode->frequency_list, mnode->freq_size,
+                  sizeof(MarkovNodeFrequency), compare_frequency_desc);
+            // Positions moved; rebuilt on demand if training goes on
+            drop_successor_index(mnode);
+        }
+    }
+}
+
+/**
+ * Unlink node from the database and free it together with its MarkovNode.
+ */
+void remove_from_database(MarkovChain *markov_chain, Node *prev, Node *node)
+{
+    if (!markov_chain || !markov_chain->database || !node)
+    {
+        return;
+    }
+    LinkedList *database = markov_chain->database;
+    if (prev)
+    {
+        prev->next = node->next;
+    }
+    else
+    {
+        database->first = node->next;
+    }
+    if (database->last == node)
+    {
+        database->last = prev;
+    }
+    database->size--;
+
+    MarkovNode *markov_node = node->data;
+    if (markov_node)
+    {
+        for (size_t i = 0; i < markov_node->freq_size; i++)
+        {
+            markov_node->frequency_list[i].markov_node->in_degree--;
+        }
+        free(markov_node->frequency_list);
+        drop_successor_index(markov_node);
+        if (markov_node->data)
+        {
+            markov_chain->free_data(markov_node->data);
+        }
+        free(markov_node);
+    }
+    free(node);
+}
+
+/**
+ * Give the nodes consecutive ids in database order.
+ */
+void renumber_database(MarkovChain *markov_chain)
+{
+    if (!markov_chain || !markov_chain->database)
+    {
+        return;
+    }
+    size_t id = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next)
+    {
+        ((MarkovNode *)cur->data)->id = id++;
+    }
+}
+
 /**
  * Free the entire database (all Nodes, MarkovNodes, frequency lists, etc.)
  */
@@ -174,6 +448,7 @@ void free_database(MarkovChain **chain_ptr)
                 // free the frequency list
                 free(markov_node->frequency_list);
                 markov_node->frequency_list = NULL;
+                drop_successor_index(markov_node);
 
                 // free the user data (Cell*)
                 if (markov_node->data)
@@ -277,6 +552,60 @@ MarkovNode* get_next_random_node(MarkovNode* cur_markov_node) {
     }
     return NULL; // theoretically never happens
 }
+/**
+ * splitmix64 scrambles the seed, so nearby seeds give unrelated streams
+ */
+void markov_rng_seed(MarkovRng *rng, uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    rng->state = z ? z : 0x9E3779B97F4A7C15ULL; // xorshift needs non-zero
+}
+
+/**
+ * xorshift64* step, reduced to [0, bound) by a multiply-shift
+ */
+uint64_t markov_rng_below(MarkovRng *rng, uint64_t bound) {
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    uint64_t r = (x * 0x2545F4914F6CDD1DULL) >> 32;
+    if (bound <= UINT32_MAX) {
+        return (r * bound) >> 32;
+    }
+    return (x * 0x2545F4914F6CDD1DULL) % bound;
+}
+
+/**
+ * Weighted-random next node, using rng instead of rand()
+ */
+MarkovNode *get_next_random_node_r(MarkovNode *cur_markov_node,
+                                   MarkovRng *rng) {
+    if (!cur_markov_node || !cur_markov_node->frequency_list || !rng) {
+        return NULL;
+    }
+    long long total_frequency = 0;
+    for (size_t i = 0; i < cur_markov_node->freq_size; i++) {
+        total_frequency += cur_markov_node->frequency_list[i].frequency;
+    }
+    if (total_frequency == 0) {
+        return NULL;
+    }
+    long long random_num = (long long)markov_rng_below(
+        rng, (uint64_t)total_frequency);
+    long long cumulative = 0;
+    for (size_t i = 0; i < cur_markov_node->freq_size; i++) {
+        cumulative += cur_markov_node->frequency_list[i].frequency;
+        if (cumulative > random_num) {
+            return cur_markov_node->frequency_list[i].markov_node;
+        }
+    }
+    return NULL;
+}
+
 static const void *prev_data = NULL;
 
 void reset_sequence_printing() {
@@ -5,6 +5,7 @@
 #include <stdio.h>    // For printf(), sscanf()
 #include <stdlib.h>   // For exit(), malloc()
 #include <stdbool.h>  // for bool
+#include <stdint.h>   // for uint64_t
 
 // Don't change the macros!
 #define ALLOCATION_ERROR_MESSAGE "Allocation failure: Failed to allocate" \
@@ -16,6 +17,7 @@ typedef int    (*comp_func)(const void *data1, const void *data2);
 typedef void   (*free_data_func)(void *data);
 typedef void*  (*copy_func)(const void *data);
 typedef bool   (*is_last_func)(const void *data);
+typedef size_t (*hash_func)(const void *data);
 
 /***************************/
 /*        STRUCTS          */
@@ -24,6 +26,7 @@ typedef bool   (*is_last_func)(const void *data);
 typedef struct MarkovNodeFrequency {
     struct MarkovNode *markov_node;
     int frequency;
+    int bucket;  // Training budget bucket the entry was added in, else 0
 } MarkovNodeFrequency;
 
 typedef struct MarkovNode {
@@ -31,8 +34,20 @@ typedef struct MarkovNode {
     MarkovNodeFrequency *frequency_list;
     size_t freq_size;      // How many valid entries are in frequency_list
     size_t freq_capacity;  // How many entries were allocated
+    size_t in_degree;      // How many frequency lists reference this node
+    size_t id;             // Position in the database, 0 .. size - 1
+    // Successor lookup for high-degree nodes, NULL for small lists
+    struct SuccessorIndex *successor_index;
 } MarkovNode;
 
+/**
+ * Random stream owned by one thread, for sampling without the shared state
+ * of rand(). Streams seeded with different values are independent.
+ */
+typedef struct MarkovRng {
+    uint64_t state;
+} MarkovRng;
+
 typedef struct MarkovChain {
     LinkedList *database;
 
@@ -60,12 +75,65 @@ Node *get_node_from_database(MarkovChain *markov_chain, void *data_ptr);
  */
 Node *add_to_database(MarkovChain *markov_chain, void *data_ptr);
 
+/**
+ * Create a new node for data_ptr at the end of the database without
+ * checking whether data_ptr is already there. Only for callers that know
+ * it is new, e.g. through their own index.
+ */
+Node *append_to_database(MarkovChain *markov_chain, void *data_ptr);
+
 /**
  * Add second_node to the freq list of the first_node, updating frequency
  * or allocating more space if needed.
  */
 int add_node_to_frequency_list(MarkovNode *first_node, MarkovNode *second_node);
 
+/**
+ * Undo one add_node_to_frequency_list(first_node, second_node): decrement
+ * the frequency, and drop the entry when it reaches zero. The last entry
+ * of the list then takes its place, so list order is not preserved.
+ * @return EXIT_FAILURE if second_node is not a successor of first_node
+ */
+int remove_node_from_frequency_list(MarkovNode *first_node,
+                                    MarkovNode *second_node);
+
+/**
+ * Set the number of successors from which add_node_to_frequency_list()
+ * looks them up through a hash index instead of a linear scan (16 by
+ * default, 0 to never index). Only affects speed, never the lists.
+ */
+void set_successor_index_threshold(size_t threshold);
+
+/**
+ * Free the successor index of node. Must be called by code that reorders
+ * or compacts node->frequency_list; the index is rebuilt when needed.
+ */
+void drop_successor_index(MarkovNode *node);
+
+/**
+ * Bytes held by the successor index of node, 0 if it has none.
+ */
+size_t successor_index_bytes(const MarkovNode *node);
+
+/**
+ * Sort the frequency list of every node by descending frequency, so the
+ * most likely successors come first. Sampling probabilities are unchanged.
+ */
+void sort_frequency_lists(MarkovChain *markov_chain);
+
+/**
+ * Unlink node from markov_chain->database and free it with its contents.
+ * The caller must make sure no frequency list still references it.
+ * @param prev the node preceding node in the database, NULL if node is first
+ */
+void remove_from_database(MarkovChain *markov_chain, Node *prev, Node *node);
+
+/**
+ * Reassign node ids 0 .. size - 1 in database order. Must be called after
+ * nodes were removed, before ids are used again.
+ */
+void renumber_database(MarkovChain *markov_chain);
+
 /**
  * Free markov_chain and all of its contents from memory.
  */
@@ -81,6 +149,23 @@ MarkovNode *get_first_random_node(MarkovChain* markov_chain);
  */
 MarkovNode *get_next_random_node(MarkovNode *cur_markov_node);
 
+/**
+ * Seed rng; any seed, including 0, gives a usable stream.
+ */
+void markov_rng_seed(MarkovRng *rng, uint64_t seed);
+
+/**
+ * Return a random number in [0, bound) from rng. bound must be positive.
+ */
+uint64_t markov_rng_below(MarkovRng *rng, uint64_t bound);
+
+/**
+ * Like get_next_random_node(), but drawing from rng instead of rand(), so
+ * threads can sample the same read-only chain concurrently.
+ */
+MarkovNode *get_next_random_node_r(MarkovNode *cur_markov_node,
+                                   MarkovRng *rng);
+
 /**
  * Generate and print a random chain (like “Random Walk”).
  */
@@ -0,0 +1,138 @@
+#include "node_index.h"
+
+#define MIN_CAPACITY 16
+// Grow once the table is more than 70% full
+#define MAX_LOAD_PERCENT 70
+
+static size_t capacity_for(size_t expected) {
+    size_t capacity = MIN_CAPACITY;
+    while (expected * 100 >= capacity * MAX_LOAD_PERCENT) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+int node_index_init(NodeIndex *index, size_t expected, hash_func hash,
+                    comp_func comp) {
+    if (!index || !hash || !comp) {
+        return 1;
+    }
+    index->capacity = capacity_for(expected);
+    index->slots = calloc(index->capacity, sizeof(NodeIndexSlot));
+    if (!index->slots) {
+        return 1;
+    }
+    index->count = 0;
+    index->hash = hash;
+    index->comp = comp;
+    return 0;
+}
+
+void node_index_destroy(NodeIndex *index) {
+    if (!index) {
+        return;
+    }
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+/**
+ * Return the slot holding data, or the empty slot where it belongs.
+ */
+static NodeIndexSlot *probe(const NodeIndex *index, const void *data,
+                            size_t hash) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+    while (index->slots[i].node) {
+        NodeIndexSlot *slot = &index->slots[i];
+        if (slot->hash == hash && index->comp(slot->node->data, data) == 0) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+    return &index->slots[i];
+}
+
+static int grow(NodeIndex *index) {
+    NodeIndexSlot *old_slots = index->slots;
+    size_t old_capacity = index->capacity;
+    NodeIndexSlot *slots = calloc(old_capacity * 2, sizeof(NodeIndexSlot));
+    if (!slots) {
+        return 1;
+    }
+    index->slots = slots;
+    index->capacity = old_capacity * 2;
+    size_t mask = index->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old_slots[i].node) {
+            continue;
+        }
+        // Keys are unique, so only an empty slot has to be found
+        size_t j = old_slots[i].hash & mask;
+        while (slots[j].node) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = old_slots[i];
+    }
+    free(old_slots);
+    return 0;
+}
+
+int node_index_insert(NodeIndex *index, MarkovNode *node, size_t value) {
+    if (!index || !node) {
+        return 1;
+    }
+    if ((index->count + 1) * 100 > index->capacity * MAX_LOAD_PERCENT &&
+        grow(index) != 0) {
+        return 1;
+    }
+    size_t hash = index->hash(node->data);
+    NodeIndexSlot *slot = probe(index, node->data, hash);
+    if (!slot->node) {
+        index->count++;
+    }
+    *slot = (NodeIndexSlot) {node, hash, value};
+    return 0;
+}
+
+int node_index_remove(NodeIndex *index, const void *data) {
+    if (!index || !index->slots || !data) {
+        return 1;
+    }
+    NodeIndexSlot *slot = probe(index, data, index->hash(data));
+    if (!slot->node) {
+        return 1;
+    }
+    // Backward-shift deletion: pull later entries of the run into the hole
+    size_t mask = index->capacity - 1;
+    size_t hole = (size_t)(slot - index->slots);
+    for (size_t next = (hole + 1) & mask; index->slots[next].node;
+         next = (next + 1) & mask) {
+        size_t home = index->slots[next].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+    }
+    index->slots[hole].node = NULL;
+    index->count--;
+    return 0;
+}
+
+const NodeIndexSlot *node_index_find(const NodeIndex *index, const void *data) {
+    if (!index || !index->slots || !data) {
+        return NULL;
+    }
+    const NodeIndexSlot *slot = probe(index, data, index->hash(data));
+    return slot->node ? slot : NULL;
+}
+
+NodeIndexSlot *node_index_find_mutable(NodeIndex *index, const void *data) {
+    if (!index || !index->slots || !data) {
+        return NULL;
+    }
+    NodeIndexSlot *slot = probe(index, data, index->hash(data));
+    return slot->node ? slot : NULL;
+}
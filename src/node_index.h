@@ -0,0 +1,72 @@
+#ifndef _NODE_INDEX_H
+#define _NODE_INDEX_H
+
+#include "markov_chain.h"
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+typedef struct NodeIndexSlot {
+    MarkovNode *node;  // NULL for an empty slot
+    size_t hash;       // cached hash of node->data
+    size_t value;      // caller-defined, e.g. a row number
+} NodeIndexSlot;
+
+/**
+ * Open-addressing hash table from node data to MarkovNode, using the
+ * chain's comp_func for equality. Lookups cost O(1) on average instead of
+ * the O(n) scan of get_node_from_database().
+ */
+typedef struct NodeIndex {
+    NodeIndexSlot *slots;
+    size_t capacity;  // power of two
+    size_t count;
+    hash_func hash;
+    comp_func comp;
+} NodeIndex;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Initialize an empty index sized for expected entries.
+ * @return 0 on success, 1 otherwise
+ */
+int node_index_init(NodeIndex *index, size_t expected, hash_func hash,
+                    comp_func comp);
+
+/**
+ * Free the slots of index. Indexed nodes are not freed.
+ */
+void node_index_destroy(NodeIndex *index);
+
+/**
+ * Insert node with the given value, or update the value if node->data is
+ * already indexed.
+ * @return 0 on success, 1 on allocation failure
+ */
+int node_index_insert(NodeIndex *index, MarkovNode *node, size_t value);
+
+/**
+ * Remove data from index. Other slots may move.
+ * @return 0 on success, 1 if data is not indexed
+ */
+int node_index_remove(NodeIndex *index, const void *data);
+
+/**
+ * Find the slot of data.
+ * @return the slot, or NULL if data is not indexed
+ */
+const NodeIndexSlot *node_index_find(const NodeIndex *index, const void *data);
+
+/**
+ * Like node_index_find(), but the value of the slot may be changed in
+ * place. Unlike node_index_insert(), this never allocates. The slot stays
+ * valid until the next insertion or removal.
+ * @return the slot, or NULL if data is not indexed
+ */
+NodeIndexSlot *node_index_find_mutable(NodeIndex *index, const void *data);
+
+#endif /* _NODE_INDEX_H */
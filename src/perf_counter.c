@@ -0,0 +1,63 @@
+#define _GNU_SOURCE
+#include "perf_counter.h"
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+int perf_counter_open(PerfCounter *counter) {
+    counter->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    // Allowed without privileges as long as perf_event_paranoid <= 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0) {
+        counter->fd = (int)fd;
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+void perf_counter_start(PerfCounter *counter) {
+#ifdef __linux__
+    if (counter->fd >= 0) {
+        ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)counter;
+#endif
+}
+
+long long perf_counter_stop(PerfCounter *counter) {
+#ifdef __linux__
+    long long count;
+    if (counter->fd >= 0) {
+        ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter->fd, &count, sizeof(count)) == sizeof(count)) {
+            return count;
+        }
+    }
+#else
+    (void)counter;
+#endif
+    return -1;
+}
+
+void perf_counter_close(PerfCounter *counter) {
+    if (counter->fd >= 0) {
+        close(counter->fd);
+    }
+    counter->fd = -1;
+}
@@ -0,0 +1,33 @@
+#ifndef _PERF_COUNTER_H
+#define _PERF_COUNTER_H
+
+/**
+ * Hardware cache-miss counter of the calling thread, read through
+ * perf_event_open(2) on Linux. Where the kernel or the machine does not
+ * provide it, the counter stays closed and reads return -1, so callers can
+ * report the misses when they are known and the timings either way.
+ */
+typedef struct PerfCounter {
+    int fd;  // -1 when unavailable
+} PerfCounter;
+
+/**
+ * Open a counter of last-level cache misses in user space.
+ * @return 0 on success, 1 if cache misses cannot be counted here
+ */
+int perf_counter_open(PerfCounter *counter);
+
+/**
+ * Reset the counter to zero and start counting.
+ */
+void perf_counter_start(PerfCounter *counter);
+
+/**
+ * Stop counting.
+ * @return misses since perf_counter_start(), or -1 if unavailable
+ */
+long long perf_counter_stop(PerfCounter *counter);
+
+void perf_counter_close(PerfCounter *counter);
+
+#endif /* _PERF_COUNTER_H */
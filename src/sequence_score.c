@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sequence_score.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+// Sequences claimed by a worker at a time
+#define SCORE_CHUNK 256
+
+typedef struct Successor {
+    uint32_t row;
+    int count;
+} Successor;
+
+static int compare_successors(const void *a, const void *b) {
+    uint32_t ra = ((const Successor *)a)->row;
+    uint32_t rb = ((const Successor *)b)->row;
+    return (ra > rb) - (ra < rb);
+}
+
+void score_model_free(ScoreModel *model) {
+    if (!model) {
+        return;
+    }
+    node_index_destroy(&model->index);
+    free(model->row_start);
+    free(model->successors);
+    free(model->counts);
+    free(model->row_totals);
+    memset(model, 0, sizeof(*model));
+}
+
+int score_model_build(ScoreModel *model, MarkovChain *markov_chain,
+                      hash_func hash, double smoothing) {
+    if (!model || !markov_chain || !markov_chain->database || !hash ||
+        smoothing <= 0) {
+        return 1;
+    }
+    memset(model, 0, sizeof(*model));
+    model->smoothing = smoothing;
+
+    size_t rows = 0, edges = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        rows++;
+        edges += ((MarkovNode *)cur->data)->freq_size;
+    }
+    if (node_index_init(&model->index, rows, hash,
+                        markov_chain->comp_func) != 0) {
+        return 1;
+    }
+    model->rows = rows;
+    model->row_start = malloc((rows + 1) * sizeof(size_t));
+    model->successors = malloc((edges ? edges : 1) * sizeof(uint32_t));
+    model->counts = malloc((edges ? edges : 1) * sizeof(int));
+    model->row_totals = malloc((rows ? rows : 1) * sizeof(long long));
+    Successor *scratch = malloc((edges ? edges : 1) * sizeof(Successor));
+    if (!model->row_start || !model->successors || !model->counts ||
+        !model->row_totals || !scratch) {
+        free(scratch);
+        score_model_free(model);
+        return 1;
+    }
+
+    size_t row = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        if (node_index_insert(&model->index, cur->data, row++) != 0) {
+            free(scratch);
+            score_model_free(model);
+            return 1;
+        }
+    }
+
+    size_t offset = 0;
+    row = 0;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        MarkovNode *mnode = cur->data;
+        long long total = 0;
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            MarkovNodeFrequency *entry = &mnode->frequency_list[i];
+            const NodeIndexSlot *slot =
+                node_index_find(&model->index, entry->markov_node->data);
+            scratch[i] = (Successor) {(uint32_t)slot->value, entry->frequency};
+            total += entry->frequency;
+        }
+        qsort(scratch, mnode->freq_size, sizeof(Successor),
+              compare_successors);
+        model->row_start[row] = offset;
+        for (size_t i = 0; i < mnode->freq_size; i++) {
+            model->successors[offset] = scratch[i].row;
+            model->counts[offset] = scratch[i].count;
+            offset++;
+        }
+        model->row_totals[row] = total;
+        row++;
+    }
+    model->row_start[rows] = offset;
+    free(scratch);
+    return 0;
+}
+
+double score_transition(const ScoreModel *model, size_t from, size_t to) {
+    // The vocabulary plus one bucket for every unknown token
+    double outcomes = (double)model->rows + 1.0;
+    if (from == SIZE_MAX) {
+        return 1.0 / outcomes;
+    }
+    long long count = 0;
+    if (to != SIZE_MAX) {
+        size_t lo = model->row_start[from];
+        size_t hi = model->row_start[from + 1];
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (model->successors[mid] < to) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < model->row_start[from + 1] && model->successors[lo] == to) {
+            count = model->counts[lo];
+        }
+    }
+    return ((double)count + model->smoothing) /
+           ((double)model->row_totals[from] + model->smoothing * outcomes);
+}
+
+static size_t row_of(const ScoreModel *model, const void *token) {
+    const NodeIndexSlot *slot = node_index_find(&model->index, token);
+    return slot ? slot->value : SIZE_MAX;
+}
+
+static void score_one(const ScoreModel *model, const void *const *tokens,
+                      size_t length, SequenceScore *result) {
+    *result = (SequenceScore) {0.0, 1.0, 0, 0};
+    if (length == 0) {
+        return;
+    }
+    size_t prev = row_of(model, tokens[0]);
+    result->unknown += prev == SIZE_MAX;
+    for (size_t i = 1; i < length; i++) {
+        size_t cur = row_of(model, tokens[i]);
+        result->unknown += cur == SIZE_MAX;
+        result->log_prob += log(score_transition(model, prev, cur));
+        result->transitions++;
+        prev = cur;
+    }
+    if (result->transitions > 0) {
+        result->perplexity = exp(-result->log_prob /
+                                 (double)result->transitions);
+    }
+}
+
+typedef struct ScoreJob {
+    const ScoreModel *model;
+    const ScoreBatch *batch;
+    SequenceScore *results;
+    size_t next;  // next unclaimed sequence, shared by all workers
+} ScoreJob;
+
+static void *score_worker(void *arg) {
+    ScoreJob *job = arg;
+    const ScoreBatch *batch = job->batch;
+    for (;;) {
+        size_t begin = __atomic_fetch_add(&job->next, SCORE_CHUNK,
+                                          __ATOMIC_RELAXED);
+        if (begin >= batch->count) {
+            return NULL;
+        }
+        size_t end = begin + SCORE_CHUNK < batch->count ? begin + SCORE_CHUNK
+                                                        : batch->count;
+        for (size_t i = begin; i < end; i++) {
+            score_one(job->model, batch->tokens + batch->offsets[i],
+                      batch->offsets[i + 1] - batch->offsets[i],
+                      &job->results[i]);
+        }
+    }
+}
+
+int score_sequences(const ScoreModel *model, const ScoreBatch *batch,
+                    SequenceScore *results, int num_threads) {
+    if (!model || !batch || !results) {
+        return 1;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    ScoreJob job = {model, batch, results, 0};
+    pthread_t *threads = malloc((size_t)num_threads * sizeof(pthread_t));
+    if (!threads) {
+        return 1;
+    }
+    // The calling thread works too, so only num_threads - 1 are started
+    int started = 0;
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[started], NULL, score_worker, &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    score_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _SEQUENCE_SCORE_H
+#define _SEQUENCE_SCORE_H
+
+#include "markov_chain.h"
+#include "node_index.h"
+#include <stdint.h>
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Read-only scoring view of a trained chain. Every node gets a row; each
+ * row keeps its successors sorted by row number (CSR layout), so a
+ * transition count is found by binary search instead of a scan of
+ * frequency_list. Safe to share between threads.
+ */
+typedef struct ScoreModel {
+    NodeIndex index;         // node data -> row
+    size_t rows;
+    size_t *row_start;       // rows + 1 offsets into successors/counts
+    uint32_t *successors;    // successor rows, ascending within a row
+    int *counts;
+    long long *row_totals;   // sum of counts of every row
+    double smoothing;        // additive (Lidstone) smoothing constant
+} ScoreModel;
+
+/**
+ * A batch of token sequences in one flat array: sequence i is
+ * tokens[offsets[i]] .. tokens[offsets[i + 1] - 1].
+ */
+typedef struct ScoreBatch {
+    const void *const *tokens;
+    const size_t *offsets;  // count + 1 entries
+    size_t count;
+} ScoreBatch;
+
+typedef struct SequenceScore {
+    double log_prob;     // natural log of P(w2..wn | w1)
+    double perplexity;   // exp(-log_prob / transitions), 1 if no transition
+    size_t transitions;
+    size_t unknown;      // tokens missing from the chain
+} SequenceScore;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Build a scoring view of markov_chain.
+ * @param hash hash function consistent with markov_chain->comp_func
+ * @param smoothing added to every transition count, must be positive
+ * @return 0 on success, 1 on allocation failure
+ */
+int score_model_build(ScoreModel *model, MarkovChain *markov_chain,
+                      hash_func hash, double smoothing);
+
+void score_model_free(ScoreModel *model);
+
+/**
+ * Smoothed probability of moving from row from to row to. Either may be
+ * SIZE_MAX for a token missing from the chain.
+ */
+double score_transition(const ScoreModel *model, size_t from, size_t to);
+
+/**
+ * Score every sequence of batch, spreading the work over num_threads
+ * threads.
+ * @param results count entries, filled in batch order
+ * @return 0 on success, 1 if the threads could not be started
+ */
+int score_sequences(const ScoreModel *model, const ScoreBatch *batch,
+                    SequenceScore *results, int num_threads);
+
+#endif /* _SEQUENCE_SCORE_H */
@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sliding_window.h"
+#include "stopwatch.h"
+#include <string.h>
+
+#define MIN_EPOCH_CAPACITY 1024
+// Dead words are removed once they are this fraction of the chain
+#define SWEEP_DIVISOR 4
+
+int sliding_window_init(SlidingWindow *window, MarkovChain *markov_chain,
+                        int num_epochs, hash_func hash) {
+    if (!window || !markov_chain || !markov_chain->database || !hash ||
+        num_epochs < 1 || markov_chain->database->size != 0) {
+        return EXIT_FAILURE;
+    }
+    memset(window, 0, sizeof(*window));
+    window->markov_chain = markov_chain;
+    window->num_epochs = num_epochs;
+    window->epochs = calloc((size_t)num_epochs, sizeof(WindowEpoch));
+    if (!window->epochs ||
+        node_index_init(&window->words, 1024, hash,
+                        markov_chain->comp_func) != 0) {
+        free(window->epochs);
+        window->epochs = NULL;
+        return EXIT_FAILURE;
+    }
+    window->stats.epochs = 1;
+    return EXIT_SUCCESS;
+}
+
+void sliding_window_destroy(SlidingWindow *window) {
+    if (!window) {
+        return;
+    }
+    for (int i = 0; window->epochs && i < window->num_epochs; i++) {
+        free(window->epochs[i].entries);
+    }
+    free(window->epochs);
+    node_index_destroy(&window->words);
+    window->epochs = NULL;
+}
+
+static int log_entry(WindowEpoch *epoch, MarkovNode *from, MarkovNode *to) {
+    if (epoch->size == epoch->capacity) {
+        size_t capacity = epoch->capacity ? epoch->capacity * 2
+                                          : MIN_EPOCH_CAPACITY;
+        WindowEntry *entries = realloc(epoch->entries,
+                                       capacity * sizeof(WindowEntry));
+        if (!entries) {
+            return EXIT_FAILURE;
+        }
+        epoch->entries = entries;
+        epoch->capacity = capacity;
+    }
+    epoch->entries[epoch->size].from = from;
+    epoch->entries[epoch->size].to = to;
+    epoch->size++;
+    return EXIT_SUCCESS;
+}
+
+MarkovNode *sliding_window_add(SlidingWindow *window, MarkovNode *prev,
+                               void *data) {
+    MarkovChain *markov_chain = window->markov_chain;
+    MarkovNode *node;
+    NodeIndexSlot *slot = node_index_find_mutable(&window->words, data);
+    if (slot) {
+        node = slot->node;
+        if (slot->value == 0) {
+            window->dead_nodes--; // back before it was removed
+        }
+        slot->value++;
+    } else {
+        Node *added = append_to_database(markov_chain, data);
+        if (!added) {
+            return NULL;
+        }
+        node = added->data;
+        if (node_index_insert(&window->words, node, 1) != 0) {
+            printf(ALLOCATION_ERROR_MESSAGE);
+            return NULL;
+        }
+    }
+
+    MarkovNode *from = NULL;
+    if (prev && !markov_chain->is_last(prev->data)) {
+        if (add_node_to_frequency_list(prev, node) != EXIT_SUCCESS) {
+            return NULL;
+        }
+        from = prev;
+    }
+    if (log_entry(&window->epochs[window->current], from, node)
+        != EXIT_SUCCESS) {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        return NULL;
+    }
+    window->stats.occurrences_added++;
+    return node;
+}
+
+/**
+ * Take the occurrences of epoch out of the chain.
+ */
+static void expire_epoch(SlidingWindow *window, WindowEpoch *epoch) {
+    for (size_t i = 0; i < epoch->size; i++) {
+        WindowEntry *entry = &epoch->entries[i];
+        if (entry->from) {
+            size_t degree = entry->from->freq_size;
+            remove_node_from_frequency_list(entry->from, entry->to);
+            window->stats.edges_removed += entry->from->freq_size < degree;
+        }
+        NodeIndexSlot *slot = node_index_find_mutable(&window->words,
+                                                      entry->to->data);
+        if (--slot->value == 0) {
+            window->dead_nodes++;
+        }
+    }
+    window->stats.occurrences_expired += epoch->size;
+    window->stats.epochs_expired++;
+    epoch->size = 0;
+}
+
+/**
+ * Remove the words without occurrences in the window. Their transitions
+ * all expired with them.
+ */
+static void sweep(SlidingWindow *window) {
+    MarkovChain *markov_chain = window->markov_chain;
+    Node *prev = NULL;
+    Node *cur = markov_chain->database->first;
+    while (cur) {
+        Node *next = cur->next;
+        MarkovNode *mnode = cur->data;
+        const NodeIndexSlot *slot = node_index_find(&window->words,
+                                                    mnode->data);
+        if (slot->value == 0) {
+            node_index_remove(&window->words, mnode->data);
+            remove_from_database(markov_chain, prev, cur);
+            window->stats.nodes_reclaimed++;
+        } else {
+            prev = cur;
+        }
+        cur = next;
+    }
+    renumber_database(markov_chain);
+    window->dead_nodes = 0;
+    window->stats.sweeps++;
+}
+
+int sliding_window_advance(SlidingWindow *window) {
+    if (!window || !window->epochs) {
+        return EXIT_FAILURE;
+    }
+    double start = stopwatch_now();
+    window->current = (window->current + 1) % window->num_epochs;
+    window->stats.epochs++;
+    // The bucket being reused holds the epoch that just left the window
+    WindowEpoch *oldest = &window->epochs[window->current];
+    if (window->stats.epochs > (size_t)window->num_epochs) {
+        expire_epoch(window, oldest);
+    }
+    if (window->dead_nodes * SWEEP_DIVISOR >
+        (size_t)window->markov_chain->database->size) {
+        sweep(window);
+    }
+    window->stats.expire_seconds += stopwatch_now() - start;
+    return EXIT_SUCCESS;
+}
+
+void sliding_window_finish(SlidingWindow *window) {
+    if (!window || !window->epochs) {
+        return;
+    }
+    double start = stopwatch_now();
+    if (window->dead_nodes > 0) {
+        sweep(window);
+    }
+    window->stats.expire_seconds += stopwatch_now() - start;
+}
+
+void print_window_stats(FILE *out, const WindowStats *stats) {
+    if (!out || !stats) {
+        return;
+    }
+    fprintf(out, "Sliding window: %zu epochs, %zu expired\n", stats->epochs,
+            stats->epochs_expired);
+    fprintf(out, "  %llu occurrences added, %llu expired\n",
+            stats->occurrences_added, stats->occurrences_expired);
+    fprintf(out, "  %llu transitions and %zu words reclaimed in %zu sweeps\n",
+            stats->edges_removed, stats->nodes_reclaimed, stats->sweeps);
+    fprintf(out, "  %.3f s expiring (%.1f us per epoch)\n",
+            stats->expire_seconds,
+            stats->epochs ? stats->expire_seconds * 1e6 / stats->epochs : 0.0);
+}
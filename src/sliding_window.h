@@ -0,0 +1,101 @@
+#ifndef _SLIDING_WINDOW_H
+#define _SLIDING_WINDOW_H
+
+#include "markov_chain.h"
+#include "node_index.h"
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+// One word occurrence seen by the window
+typedef struct WindowEntry {
+    MarkovNode *from;  // previous word, NULL if no transition was counted
+    MarkovNode *to;    // the word itself
+} WindowEntry;
+
+// Occurrences of one epoch, in training order
+typedef struct WindowEpoch {
+    WindowEntry *entries;
+    size_t size;
+    size_t capacity;
+} WindowEpoch;
+
+typedef struct WindowStats {
+    size_t epochs;            // epochs started
+    size_t epochs_expired;
+    unsigned long long occurrences_added;
+    unsigned long long occurrences_expired;
+    unsigned long long edges_removed;  // transitions whose count reached 0
+    size_t nodes_reclaimed;
+    size_t sweeps;            // passes that removed reclaimed words
+    double expire_seconds;    // time spent expiring and sweeping
+} WindowStats;
+
+/**
+ * Trains a chain on the last num_epochs epochs of a stream only. Every
+ * occurrence is logged in the bucket of its epoch; when the window moves
+ * on, the oldest bucket is replayed out of the chain in logged order
+ * (decrements commute, so the order does not matter), and counts are
+ * exactly those of the epochs inside the window. Transitions whose
+ * count reaches zero are dropped at once, and words that no longer occur
+ * in the window are removed in batches.
+ *
+ * Words are found through a hash index whose values count their
+ * occurrences inside the window, so the cost of an update depends on the
+ * data added and expired, not on the size of the chain. The only exception
+ * is the removal of dead words, which is amortized: it runs when they make
+ * up a quarter of the chain.
+ */
+typedef struct SlidingWindow {
+    MarkovChain *markov_chain;
+    NodeIndex words;       // data -> node, value = occurrences in the window
+    WindowEpoch *epochs;   // ring of num_epochs buckets
+    int num_epochs;
+    int current;           // bucket of the epoch being trained
+    size_t dead_nodes;     // words without occurrences, not removed yet
+    WindowStats stats;
+} SlidingWindow;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Start a window of num_epochs epochs over the empty markov_chain.
+ * @param hash hash function consistent with markov_chain->comp_func
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int sliding_window_init(SlidingWindow *window, MarkovChain *markov_chain,
+                        int num_epochs, hash_func hash);
+
+/**
+ * Free the log and the index of window. The chain is kept.
+ */
+void sliding_window_destroy(SlidingWindow *window);
+
+/**
+ * Train one occurrence of data in the current epoch, following prev (NULL
+ * at the start of a sequence).
+ * @return the node of data, to pass as prev with the next word, or NULL on
+ *         allocation failure
+ */
+MarkovNode *sliding_window_add(SlidingWindow *window, MarkovNode *prev,
+                               void *data);
+
+/**
+ * Start the next epoch. Once the window is full, the oldest epoch is
+ * expired first. Must be called between sequences: nodes may be freed.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int sliding_window_advance(SlidingWindow *window);
+
+/**
+ * Remove the words that left the window and renumber the chain, so it can
+ * be used for generation.
+ */
+void sliding_window_finish(SlidingWindow *window);
+
+void print_window_stats(FILE *out, const WindowStats *stats);
+
+#endif /* _SLIDING_WINDOW_H */
@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
 #include <string.h> // For strlen(), strcmp(), strcpy()
 #include "markov_chain.h"
+#include "stopwatch.h"
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define BASE_10 10
 #define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
@@ -14,6 +18,13 @@
 
 #define NUM_ARGS_ERROR "Usage: invalid number of arguments"
 
+#define RACE_MIN_PLAYERS 2
+#define RACE_MAX_PLAYERS 8
+// Games still running after this many rounds are counted as unfinished
+#define RACE_MAX_ROUNDS 1000
+#define RACE_HISTOGRAM_BUCKET 10
+#define RACE_HISTOGRAM_BUCKETS 15
+
 /**
  * represents the transitions by ladders and snakes in the game
  * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
@@ -243,6 +254,293 @@ int fill_database_snakes(MarkovChain* markov_chain)
     return EXIT_SUCCESS;
 }
 
+/**
+ * The board as a compact transition table for race simulation. Snake and
+ * ladder cells are never rested on, so every move is resolved to the cell
+ * where the token stops at the end of the turn.
+ */
+typedef struct RaceBoard {
+    unsigned char num_moves[BOARD_SIZE];
+    unsigned char moves[BOARD_SIZE][DICE_MAX];      // cell index after a move
+    unsigned int cumulative[BOARD_SIZE][DICE_MAX];  // running move weights
+    unsigned char start;
+    unsigned char goal;
+} RaceBoard;
+
+/**
+ * Totals of a simulation: wins per seat (seat 0 moves first) and game
+ * lengths in rounds.
+ */
+typedef struct RaceResults {
+    unsigned long long seat_wins[RACE_MAX_PLAYERS];
+    unsigned long long lengths[RACE_MAX_ROUNDS + 1];
+    unsigned long long unfinished;
+} RaceResults;
+
+typedef struct RaceWorker {
+    const RaceBoard *board;
+    RaceResults *totals;  // shared, merged into atomically
+    int players;
+    unsigned long long games;
+    uint64_t seed;
+    pthread_t thread;
+    bool running;  // false if the share is played on the calling thread
+} RaceWorker;
+
+static bool is_jump_cell(const Cell *cell) {
+    return cell->ladder_to != EMPTY || cell->snake_to != EMPTY;
+}
+
+/**
+ * Build the race table from the chain's frequency lists.
+ */
+void build_race_board(MarkovChain *markov_chain, RaceBoard *board)
+{
+    memset(board, 0, sizeof(*board));
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next)
+    {
+        MarkovNode *mnode = cur->data;
+        const Cell *cell = mnode->data;
+        int from = cell->number - 1;
+        if (is_jump_cell(cell))
+        {
+            continue;
+        }
+        if (markov_chain->is_last(cell))
+        {
+            board->goal = (unsigned char)from;
+        }
+        unsigned int running = 0;
+        for (size_t i = 0; i < mnode->freq_size && i < DICE_MAX; i++)
+        {
+            MarkovNode *to = mnode->frequency_list[i].markov_node;
+            // Follow snakes and ladders to where the token comes to rest
+            while (is_jump_cell(to->data) && to->freq_size > 0)
+            {
+                to = to->frequency_list[0].markov_node;
+            }
+            running += (unsigned int)mnode->frequency_list[i].frequency;
+            board->moves[from][i] = (unsigned char)(((Cell *)to->data)->number
+                                                    - 1);
+            board->cumulative[from][i] = running;
+            board->num_moves[from]++;
+        }
+    }
+    board->start = 0;
+}
+
+/**
+ * Play one game.
+ * @return the winning seat, or -1 if nobody won within RACE_MAX_ROUNDS
+ */
+static int play_race(const RaceBoard *board, int players, MarkovRng *rng,
+                     int *rounds)
+{
+    unsigned char position[RACE_MAX_PLAYERS];
+    memset(position, board->start, sizeof(position));
+    for (int round = 1; round <= RACE_MAX_ROUNDS; round++)
+    {
+        for (int seat = 0; seat < players; seat++)
+        {
+            unsigned char cell = position[seat];
+            int count = board->num_moves[cell];
+            if (count == 0)
+            {
+                continue;
+            }
+            unsigned int pick = (unsigned int)markov_rng_below(
+                rng, board->cumulative[cell][count - 1]);
+            int move = 0;
+            while (board->cumulative[cell][move] <= pick)
+            {
+                move++;
+            }
+            position[seat] = board->moves[cell][move];
+            if (position[seat] == board->goal)
+            {
+                *rounds = round;
+                return seat;
+            }
+        }
+    }
+    *rounds = RACE_MAX_ROUNDS;
+    return -1;
+}
+
+/**
+ * Worker thread: play its games into private counters, then add them to
+ * the shared totals with atomic increments.
+ */
+static void *race_worker(void *arg)
+{
+    RaceWorker *worker = arg;
+    RaceResults *local = calloc(1, sizeof(RaceResults));
+    if (!local)
+    {
+        return (void *)1;
+    }
+    MarkovRng rng;
+    markov_rng_seed(&rng, worker->seed);
+    for (unsigned long long game = 0; game < worker->games; game++)
+    {
+        int rounds;
+        int winner = play_race(worker->board, worker->players, &rng, &rounds);
+        if (winner < 0)
+        {
+            local->unfinished++;
+            continue;
+        }
+        local->seat_wins[winner]++;
+        local->lengths[rounds]++;
+    }
+
+    RaceResults *totals = worker->totals;
+    for (int seat = 0; seat < worker->players; seat++)
+    {
+        __atomic_fetch_add(&totals->seat_wins[seat], local->seat_wins[seat],
+                           __ATOMIC_RELAXED);
+    }
+    for (int rounds = 0; rounds <= RACE_MAX_ROUNDS; rounds++)
+    {
+        if (local->lengths[rounds])
+        {
+            __atomic_fetch_add(&totals->lengths[rounds],
+                               local->lengths[rounds], __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&totals->unfinished, local->unfinished,
+                       __ATOMIC_RELAXED);
+    free(local);
+    return NULL;
+}
+
+/**
+ * Smallest number of rounds by which at least fraction of the finished
+ * games were over.
+ */
+static int length_percentile(const RaceResults *results,
+                             unsigned long long finished, double fraction)
+{
+    unsigned long long seen = 0;
+    for (int rounds = 1; rounds <= RACE_MAX_ROUNDS; rounds++)
+    {
+        seen += results->lengths[rounds];
+        if (seen > 0 && (double)seen >= fraction * (double)finished)
+        {
+            return rounds;
+        }
+    }
+    return RACE_MAX_ROUNDS;
+}
+
+void print_race_results(const RaceResults *results, int players,
+                        unsigned long long games, double seconds)
+{
+    unsigned long long finished = games - results->unfinished;
+    printf("Race: %d players, %llu games\n", players, games);
+    printf("seat   wins        win rate\n");
+    for (int seat = 0; seat < players; seat++)
+    {
+        printf("%4d   %-11llu %.4f\n", seat + 1, results->seat_wins[seat],
+               games ? (double)results->seat_wins[seat] / (double)games : 0.0);
+    }
+    if (results->unfinished)
+    {
+        printf("unfinished after %d rounds: %llu\n", RACE_MAX_ROUNDS,
+               results->unfinished);
+    }
+    if (finished == 0)
+    {
+        return;
+    }
+    double total_rounds = 0;
+    for (int rounds = 1; rounds <= RACE_MAX_ROUNDS; rounds++)
+    {
+        total_rounds += (double)rounds * (double)results->lengths[rounds];
+    }
+    printf("game length (rounds): mean %.2f, p50 %d, p90 %d, p99 %d\n",
+           total_rounds / (double)finished,
+           length_percentile(results, finished, 0.5),
+           length_percentile(results, finished, 0.9),
+           length_percentile(results, finished, 0.99));
+    for (int bucket = 0; bucket < RACE_HISTOGRAM_BUCKETS; bucket++)
+    {
+        int lo = bucket * RACE_HISTOGRAM_BUCKET + 1;
+        int hi = bucket == RACE_HISTOGRAM_BUCKETS - 1
+                 ? RACE_MAX_ROUNDS : lo + RACE_HISTOGRAM_BUCKET - 1;
+        unsigned long long count = 0;
+        for (int rounds = lo; rounds <= hi; rounds++)
+        {
+            count += results->lengths[rounds];
+        }
+        printf("  %4d-%-4d %.4f\n", lo, hi, (double)count / (double)finished);
+    }
+    printf("%.0f games/s\n", seconds > 0 ? (double)games / seconds : 0.0);
+}
+
+/**
+ * Play games races of players players, split over num_threads threads
+ * with independent random streams, and print the results.
+ */
+int simulate_races(MarkovChain *markov_chain, int players,
+                   unsigned long long games, int num_threads,
+                   unsigned int seed)
+{
+    RaceBoard board;
+    build_race_board(markov_chain, &board);
+    RaceResults *totals = calloc(1, sizeof(RaceResults));
+    RaceWorker *workers = malloc((size_t)num_threads * sizeof(RaceWorker));
+    if (!totals || !workers)
+    {
+        printf(ALLOCATION_ERROR_MESSAGE);
+        free(totals);
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    double start = stopwatch_now();
+    for (int i = 0; i < num_threads; i++)
+    {
+        unsigned long long share = games / (unsigned long long)num_threads +
+            ((unsigned long long)i < games % (unsigned long long)num_threads);
+        RaceWorker *worker = &workers[i];
+        worker->board = &board;
+        worker->totals = totals;
+        worker->players = players;
+        worker->games = share;
+        worker->seed = (uint64_t)seed * 1000003u + (uint64_t)i;
+        worker->running = i > 0 && pthread_create(&worker->thread, NULL,
+                                                  race_worker, worker) == 0;
+    }
+    int failed = 0;
+    for (int i = 0; i < num_threads; i++)
+    {
+        void *status = NULL;
+        if (workers[i].running)
+        {
+            pthread_join(workers[i].thread, &status);
+        }
+        else
+        {
+            status = race_worker(&workers[i]);
+        }
+        failed |= status != NULL;
+    }
+    double seconds = stopwatch_now() - start;
+
+    if (failed)
+    {
+        printf(ALLOCATION_ERROR_MESSAGE);
+    }
+    else
+    {
+        print_race_results(totals, players, games, seconds);
+    }
+    free(totals);
+    free(workers);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 bool err_parsing_msg(const char *endptr) {
     if (errno == ERANGE) {
         printf("Error: Value out of range.\n");
@@ -254,11 +552,50 @@ bool err_parsing_msg(const char *endptr) {
     return true;
 }
 
+/**
+ * Options accepted after the positional arguments:
+ * --race PLAYERS to simulate multi-player games, --threads N.
+ */
+int parse_race_options(int argc, char *argv[], int *players, int *threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *players = 0;
+    *threads = cpus > 1 ? (int)cpus : 1;
+    for (int i = 3; i < argc; i++) {
+        int *target;
+        if (strcmp(argv[i], "--race") == 0 && i + 1 < argc) {
+            target = players;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            target = threads;
+        } else {
+            printf("Error: Unknown option '%s'.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        char *endptr;
+        errno = 0;
+        *target = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!err_parsing_msg(endptr) || *target <= 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (*players != 0 &&
+        (*players < RACE_MIN_PLAYERS || *players > RACE_MAX_PLAYERS)) {
+        printf("Error: A race needs %d to %d players.\n", RACE_MIN_PLAYERS,
+               RACE_MAX_PLAYERS);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    int players, num_threads;
+    if (argc < 3) {
         printf("%s\n", NUM_ARGS_ERROR);
         return EXIT_FAILURE;
     }
+    if (parse_race_options(argc, argv, &players, &num_threads)
+        != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
     char *endptr;
     errno = 0;
     unsigned int seed = (unsigned int)strtol(argv[1], &endptr, BASE_10);
@@ -282,6 +619,7 @@ int main(int argc, char *argv[]) {
     }
     markov_chain->database->first = NULL;
     markov_chain->database->last = NULL;
+    markov_chain->database->size = 0;
 
     // Assign function pointers
     markov_chain->print_func  = print_cell;
@@ -296,6 +634,15 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (players > 0) {
+        // num_paths is the number of games in race mode
+        int result = simulate_races(markov_chain, players,
+                                    (unsigned long long)MAX(num_paths, 0),
+                                    num_threads, seed);
+        free_database(&markov_chain);
+        return result;
+    }
+
     // Generate random paths
     for (int i = 0; i < num_paths; i++) {
         printf("Random Walk %d: ", i + 1);
@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+#include "spsc_queue.h"
+#include "stopwatch.h"
+#include <sched.h>
+#include <stdlib.h>
+
+int spsc_queue_init(SpscQueue *queue, size_t capacity) {
+    if (!queue || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return 1;
+    }
+    queue->slots = calloc(capacity, sizeof(void *));
+    if (!queue->slots) {
+        return 1;
+    }
+    queue->mask = capacity - 1;
+    queue->head = 0;
+    queue->tail = 0;
+    return 0;
+}
+
+void spsc_queue_destroy(SpscQueue *queue) {
+    if (!queue) {
+        return;
+    }
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+bool spsc_queue_push(SpscQueue *queue, void *item) {
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head > queue->mask) {
+        return false; // full
+    }
+    queue->slots[tail & queue->mask] = item;
+    // Publish the slot before the new tail becomes visible to the consumer
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void *spsc_queue_pop(SpscQueue *queue) {
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL; // empty
+    }
+    void *item = queue->slots[head & queue->mask];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+bool spsc_queue_push_wait(SpscQueue *queue, void *item, const int *stop,
+                          unsigned long long *stalls, double *wait_seconds) {
+    if (spsc_queue_push(queue, item)) {
+        return true;
+    }
+    double start = stopwatch_now();
+    (*stalls)++;
+    bool pushed = false;
+    while (!__atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+        if (spsc_queue_push(queue, item)) {
+            pushed = true;
+            break;
+        }
+    }
+    *wait_seconds += stopwatch_now() - start;
+    return pushed;
+}
+
+void *spsc_queue_pop_wait(SpscQueue *queue, const int *stop,
+                          unsigned long long *stalls, double *wait_seconds) {
+    void *item = spsc_queue_pop(queue);
+    if (item) {
+        return item;
+    }
+    double start = stopwatch_now();
+    (*stalls)++;
+    while (!__atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+        item = spsc_queue_pop(queue);
+        if (item) {
+            break;
+        }
+    }
+    *wait_seconds += stopwatch_now() - start;
+    return item;
+}
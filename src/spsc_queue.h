@@ -0,0 +1,65 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPSC_CACHE_LINE 64
+
+/**
+ * Bounded lock-free queue of pointers with exactly one producer thread and
+ * one consumer thread. head and tail live on separate cache lines so the
+ * two sides do not false-share.
+ */
+typedef struct SpscQueue {
+    void **slots;
+    size_t mask;  // capacity - 1, capacity is a power of two
+    char pad0[SPSC_CACHE_LINE];
+    size_t head;  // next slot to pop, written by the consumer only
+    char pad1[SPSC_CACHE_LINE];
+    size_t tail;  // next slot to push, written by the producer only
+    char pad2[SPSC_CACHE_LINE];
+} SpscQueue;
+
+/**
+ * Allocate a queue holding up to capacity items.
+ * @param capacity must be a power of two
+ * @return 0 on success, 1 otherwise
+ */
+int spsc_queue_init(SpscQueue *queue, size_t capacity);
+
+/**
+ * Free the slots of queue. The items themselves are not freed.
+ */
+void spsc_queue_destroy(SpscQueue *queue);
+
+/**
+ * Push item without waiting.
+ * @return true if item was queued, false if the queue is full
+ */
+bool spsc_queue_push(SpscQueue *queue, void *item);
+
+/**
+ * Pop an item without waiting.
+ * @return the oldest item, or NULL if the queue is empty
+ */
+void *spsc_queue_pop(SpscQueue *queue);
+
+/**
+ * Push item, yielding while the queue is full. Each wait counts as one stall
+ * and its duration is added to wait_seconds.
+ * @param stop checked while waiting, giving up once it becomes non-zero
+ * @return true if item was queued, false if stop was raised
+ */
+bool spsc_queue_push_wait(SpscQueue *queue, void *item, const int *stop,
+                          unsigned long long *stalls, double *wait_seconds);
+
+/**
+ * Pop an item, yielding while the queue is empty. Stalls are counted the
+ * same way as in spsc_queue_push_wait().
+ * @return the oldest item, or NULL if stop was raised
+ */
+void *spsc_queue_pop_wait(SpscQueue *queue, const int *stop,
+                          unsigned long long *stalls, double *wait_seconds);
+
+#endif /* _SPSC_QUEUE_H */
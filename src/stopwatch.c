@@ -0,0 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stopwatch.h"
+#include <time.h>
+
+double stopwatch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,9 @@
+#ifndef _STOPWATCH_H
+#define _STOPWATCH_H
+
+/**
+ * Return a monotonic timestamp in seconds, for measuring elapsed time.
+ */
+double stopwatch_now(void);
+
+#endif /* _STOPWATCH_H */
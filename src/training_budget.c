@@ -0,0 +1,220 @@
+#include "training_budget.h"
+#include <limits.h>
+#include <string.h>
+
+// Allocator bookkeeping charged for every malloc'd block
+#define ALLOCATION_OVERHEAD 16
+// After pruning, the chain should use at most this share of the limit
+#define LOW_WATER_PERCENT 75
+
+/**
+ * Estimated bytes held by node itself, without its frequency list.
+ */
+static size_t node_footprint(const TrainingBudget *budget,
+                             const MarkovNode *node) {
+    size_t bytes = sizeof(Node) + sizeof(MarkovNode) + 2 * ALLOCATION_OVERHEAD;
+    if (budget->data_size && node->data) {
+        bytes += budget->data_size(node->data) + ALLOCATION_OVERHEAD;
+    }
+    return bytes;
+}
+
+/**
+ * Estimated bytes held by the frequency list of node and its successor
+ * index.
+ */
+static size_t list_bytes(const MarkovNode *node) {
+    size_t bytes = 0;
+    if (node->freq_capacity > 0) {
+        bytes += node->freq_capacity * sizeof(MarkovNodeFrequency) +
+                 ALLOCATION_OVERHEAD;
+    }
+    if (node->successor_index) {
+        bytes += successor_index_bytes(node) + ALLOCATION_OVERHEAD;
+    }
+    return bytes;
+}
+
+void training_budget_init(TrainingBudget *budget, size_t limit_bytes,
+                          data_size_func data_size) {
+    memset(budget, 0, sizeof(*budget));
+    budget->limit_bytes = limit_bytes;
+    budget->data_size = data_size;
+}
+
+void training_budget_add_node(TrainingBudget *budget, const MarkovNode *node) {
+    if (!budget || !node) {
+        return;
+    }
+    budget->used_bytes += node_footprint(budget, node);
+}
+
+int training_budget_add_edge(TrainingBudget *budget, MarkovNode *from,
+                             MarkovNode *to) {
+    if (!budget || !from) {
+        return add_node_to_frequency_list(from, to);
+    }
+    size_t old_size = from->freq_size;
+    size_t old_bytes = list_bytes(from);
+    if (add_node_to_frequency_list(from, to) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (from->freq_size > old_size) {
+        from->frequency_list[old_size].bucket = budget->bucket;
+    }
+    budget->mass_total++;
+    budget->used_bytes += list_bytes(from);
+    budget->used_bytes -= old_bytes;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Upper bound lossy counting keeps on how often entry was seen.
+ */
+static long long estimated_count(const MarkovNodeFrequency *entry) {
+    return (long long)entry->frequency + entry->bucket;
+}
+
+/**
+ * Drop every successor of node whose estimated count is at most bucket,
+ * then give the unused part of the frequency list back to the allocator.
+ * A word that some list still points to keeps its best successor even so:
+ * a walk reaching it must be able to go on, and sparing that entry here
+ * keeps one sweep enough, where dropping it would cut the lists already
+ * swept.
+ * @param next_bucket lowered to the smallest estimated count left that was
+ *        not spared
+ */
+static void prune_successors(TrainingBudget *budget, MarkovNode *node,
+                             int bucket, long long *next_bucket) {
+    size_t spared = node->freq_size;
+    if (node->in_degree > 0) {
+        long long best = 0;
+        for (size_t i = 0; i < node->freq_size; i++) {
+            long long count = estimated_count(&node->frequency_list[i]);
+            if (count > bucket) {
+                spared = node->freq_size; // something survives anyway
+                break;
+            }
+            if (count > best) {
+                best = count;
+                spared = i;
+            }
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < node->freq_size; i++) {
+        MarkovNodeFrequency entry = node->frequency_list[i];
+        long long count = estimated_count(&entry);
+        if (i != spared) {
+            if (count <= bucket) {
+                budget->mass_dropped += (unsigned long long)entry.frequency;
+                budget->edges_pruned++;
+                entry.markov_node->in_degree--;
+                continue;
+            }
+            if (count < *next_bucket) {
+                *next_bucket = count;
+            }
+        }
+        node->frequency_list[kept++] = entry;
+    }
+    if (kept == node->freq_size) {
+        return;
+    }
+    size_t old_bytes = list_bytes(node);
+    node->freq_size = kept;
+    drop_successor_index(node);
+
+    size_t old_capacity = node->freq_capacity;
+    if (kept == 0) {
+        free(node->frequency_list);
+        node->frequency_list = NULL;
+        node->freq_capacity = 0;
+    } else if (kept <= old_capacity / 2) {
+        MarkovNodeFrequency *shrunk = realloc(
+            node->frequency_list, kept * sizeof(MarkovNodeFrequency));
+        if (shrunk) {
+            node->frequency_list = shrunk;
+            node->freq_capacity = kept;
+        }
+    }
+    budget->used_bytes -= old_bytes;
+    budget->used_bytes += list_bytes(node);
+}
+
+/**
+ * Close budget->bucket: one sweep over the chain, then the words left
+ * without any edge are dropped.
+ * @return the next bucket whose closing would drop a successor, or INT_MAX
+ *         if only spared successors are left
+ */
+static int close_bucket(TrainingBudget *budget, MarkovChain *markov_chain) {
+    long long next_bucket = INT_MAX;
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next) {
+        prune_successors(budget, cur->data, budget->bucket, &next_bucket);
+    }
+
+    // Nodes without any edge left can neither be reached nor go anywhere
+    Node *prev = NULL;
+    Node *cur = markov_chain->database->first;
+    while (cur) {
+        Node *next = cur->next;
+        MarkovNode *mnode = cur->data;
+        if (mnode->freq_size == 0 && mnode->in_degree == 0) {
+            budget->used_bytes -= node_footprint(budget, mnode);
+            budget->used_bytes -= list_bytes(mnode);
+            remove_from_database(markov_chain, prev, cur);
+            budget->nodes_pruned++;
+        } else {
+            prev = cur;
+        }
+        cur = next;
+    }
+    renumber_database(markov_chain);
+    budget->prune_passes++;
+    return (int)next_bucket;
+}
+
+int training_budget_enforce(TrainingBudget *budget, MarkovChain *markov_chain) {
+    if (!budget || !markov_chain || !markov_chain->database ||
+        budget->used_bytes <= budget->limit_bytes) {
+        return EXIT_SUCCESS;
+    }
+    size_t target = budget->limit_bytes / 100 * LOW_WATER_PERCENT;
+    while (budget->used_bytes > target) {
+        size_t pruned = budget->edges_pruned + budget->nodes_pruned;
+        budget->bucket++;
+        int next_bucket = close_bucket(budget, markov_chain);
+        if (next_bucket == INT_MAX &&
+            budget->edges_pruned + budget->nodes_pruned == pruned) {
+            // Every word left keeps the one successor it was spared
+            return budget->used_bytes > budget->limit_bytes ? EXIT_FAILURE
+                                                            : EXIT_SUCCESS;
+        }
+        if (next_bucket != INT_MAX && next_bucket - 1 > budget->bucket) {
+            // Skip the buckets whose closing would not drop anything
+            budget->bucket = next_bucket - 1;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+void print_budget_stats(FILE *out, const TrainingBudget *budget) {
+    if (!out || !budget) {
+        return;
+    }
+    double dropped = budget->mass_total
+                     ? 100.0 * (double)budget->mass_dropped /
+                       (double)budget->mass_total
+                     : 0.0;
+    fprintf(out, "Memory budget: %zu of %zu bytes used\n",
+            budget->used_bytes, budget->limit_bytes);
+    fprintf(out, "  %zu pruning passes, %d buckets closed\n",
+            budget->prune_passes, budget->bucket);
+    fprintf(out, "  %zu successors and %zu vocabulary entries pruned\n",
+            budget->edges_pruned, budget->nodes_pruned);
+    fprintf(out, "  %llu of %llu transitions dropped (%.2f%% of the "
+                 "probability mass)\n",
+            budget->mass_dropped, budget->mass_total, dropped);
+}
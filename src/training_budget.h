@@ -0,0 +1,79 @@
+#ifndef _TRAINING_BUDGET_H
+#define _TRAINING_BUDGET_H
+
+#include "markov_chain.h"
+#include <stdio.h>
+
+// Returns how many bytes the payload of one node occupies
+typedef size_t (*data_size_func)(const void *data);
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Memory budget for training. While the estimated size of the chain stays
+ * under limit_bytes nothing happens; once it goes over, rare successors are
+ * pruned by lossy counting and nodes left without any edge are dropped from
+ * the vocabulary.
+ *
+ * Training runs in buckets, and the current one ends whenever the chain
+ * outgrows the budget. Every successor entry records the last bucket closed
+ * when it was added (its frequency may have been pruned before, up to that
+ * many times), and closing bucket b sweeps the chain once, dropping the
+ * entries whose frequency plus recorded bucket is at most b.
+ */
+typedef struct TrainingBudget {
+    size_t limit_bytes;
+    size_t used_bytes;        // estimated footprint of the chain
+    data_size_func data_size; // NULL counts only the node structs
+    int bucket;               // buckets closed so far
+
+    unsigned long long mass_total;    // transitions counted during training
+    unsigned long long mass_dropped;  // transitions removed by pruning
+    size_t edges_pruned;
+    size_t nodes_pruned;
+    size_t prune_passes;
+} TrainingBudget;
+
+/***************************/
+/*   Function Declarations */
+/***************************/
+
+/**
+ * Initialize an empty budget of limit_bytes.
+ */
+void training_budget_init(TrainingBudget *budget, size_t limit_bytes,
+                          data_size_func data_size);
+
+/**
+ * Account for a node that add_to_database() just created.
+ * Does nothing if budget is NULL.
+ */
+void training_budget_add_node(TrainingBudget *budget, const MarkovNode *node);
+
+/**
+ * Add the transition from -> to with add_node_to_frequency_list() and
+ * account for it. A successor new to the list is stamped with the current
+ * bucket. With a NULL budget only the transition is added.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on allocation failure
+ */
+int training_budget_add_edge(TrainingBudget *budget, MarkovNode *from,
+                             MarkovNode *to);
+
+/**
+ * Close buckets until markov_chain fits the budget again, skipping those
+ * that would not drop anything. Must only be called between sequences,
+ * when no caller holds a pointer to a chain node.
+ * Does nothing if budget is NULL or the chain is within the limit.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if nothing is left to prune and
+ *         the chain is still over the limit
+ */
+int training_budget_enforce(TrainingBudget *budget, MarkovChain *markov_chain);
+
+/**
+ * Print memory usage, pruning counters and the dropped probability mass.
+ */
+void print_budget_stats(FILE *out, const TrainingBudget *budget);
+
+#endif /* _TRAINING_BUDGET_H */
@@ -6,17 +6,102 @@
 #define BASE_10 10
 #define READ_ALL 42
 #define LINE_MAX 1001
+#define SCORE_SMOOTHING 0.1
+#define TWEET_MAX_LENGTH 20
+#define BEAM_BENCH_MAX_WIDTH 64
+#define ANALYSIS_DAMPING 0.85
+#define ANALYSIS_TOLERANCE 1e-10
+#define ANALYSIS_MAX_ITERATIONS 1000
+#define ANALYSIS_TOP_WORDS 10
+#define CONCURRENT_PUBLISH_LINES 256
+// Publish again once the corpus trained so far grew by 1 / this
+#define CONCURRENT_PUBLISH_GROWTH 4
+#define CONCURRENT_BATCH 64
+#define CONCURRENT_MAX_IDLE_SECONDS 1.0
+// Tweets generated per request with --start when --batch is not given
+#define PROMPT_BATCH 64
+#define WINDOW_EPOCH_LINES 1000
+// --unique gives up after this many duplicates in a row
+#define UNIQUE_MAX_RETRIES 1000
+// Longest tweet of the byte-level chain, in characters
+#define TWEET_MAX_BYTES 280
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "markov_chain.h"
+#include "ingest_pipeline.h"
+#include "training_budget.h"
+#include "sequence_score.h"
+#include "beam_search.h"
+#include "chain_analysis.h"
+#include "chain_snapshot.h"
+#include "external_train.h"
+#include "batch_generate.h"
+#include "sliding_window.h"
+#include "chain_layout.h"
+#include "corpus_reader.h"
+#include "byte_chain.h"
+#include <pthread.h>
+#include <sched.h>
+#include "stopwatch.h"
+#include <unistd.h>
+
+/**
+ * Optional "--flag" arguments, accepted anywhere on the command line.
+ */
+typedef struct ProgramOptions {
+  bool pipeline;  // train with the overlapped read/tokenize/train pipeline
+  bool stats;     // report timing statistics on stderr
+  size_t memory_budget;  // bytes the chain may use while training, 0 = none
+  const char *score_path;  // file of sequences to score, one per line
+  int threads;             // worker threads for batch operations
+  double smoothing;        // additive smoothing for scoring
+  int beam_width;          // print the most likely tweets instead, 0 = off
+  bool beam_bench;         // measure beam-search latency for widths 1-64
+  int analyze_steps;       // k of the reachability analysis, -1 = off
+  int concurrent_readers;  // generate while training, 0 = off
+  size_t external_budget;  // train out of core with this much memory, 0 = off
+  int batch_size;          // generate tweets this many at a time, 0 = off
+  const char *start_word;  // start every tweet at this word, NULL = random
+  UnknownStartPolicy unknown_start;  // what to do if start_word is unknown
+  int window_epochs;       // train on the last epochs only, 0 = everything
+  int epoch_lines;         // lines per epoch of the sliding window
+  bool relayout;           // relocate the chain before generating
+  LayoutOrder layout;      // order of the relocated nodes
+  bool unique;             // only print distinct tweets
+  int max_retries;         // duplicates in a row before --unique gives up
+  int byte_order;          // use a byte-level chain of this order, 0 = off
+} ProgramOptions;
 
 bool error_parsing_msg(const char* endptr);
+int parse_options(int argc, char** argv, ProgramOptions *options,
+                  char** positional);
 int count_words_in_file(const char *file_path);
-int fill_database(FILE *fp, int words_to_read, MarkovChain *markov_chain);
+int fill_database(CorpusReader *corpus, int words_to_read,
+                  MarkovChain *markov_chain, TrainingBudget *budget);
+int fill_database_windowed(CorpusReader *corpus, int words_to_read,
+                           MarkovChain *markov_chain,
+                           const ProgramOptions *options);
+int fill_database_concurrent(CorpusReader *corpus, int words_to_read,
+                             MarkovChain *markov_chain, int num_readers,
+                             unsigned int seed);
 MarkovChain* initialize_markov_chain();
+int score_file(const char *path, MarkovChain *markov_chain,
+               const ProgramOptions *options);
+int print_beam_tweets(MarkovChain *markov_chain, int num_tweets,
+                      int beam_width);
+int beam_benchmark(MarkovChain *markov_chain, int num_requests);
+int analyze_chain(MarkovChain *markov_chain, int k, int num_threads);
+int print_batch_tweets(MarkovChain *markov_chain, int num_tweets,
+                       unsigned int seed, const ProgramOptions *options);
+int print_unique_tweets(MarkovChain *markov_chain, int num_tweets,
+                        unsigned int seed, const ProgramOptions *options);
+int print_byte_tweets(const char *file_path, int num_tweets,
+                      unsigned int seed, const ProgramOptions *options);
 /**
  * Determines if a word is a terminal word (ends with a period).
  * Returns true if it is, false otherwise.
@@ -65,6 +150,23 @@ void* copy_string(const void *data) {
   }
   return copy;
 }
+/**
+ * FNV-1a hash of a string, consistent with compare_strings.
+ */
+size_t hash_string(const void *data) {
+  size_t hash = (size_t)14695981039346656037ULL;
+  for (const unsigned char *c = data; *c; c++) {
+    hash ^= *c;
+    hash *= (size_t)1099511628211ULL;
+  }
+  return hash;
+}
+/**
+ * Returns the number of bytes a copied string occupies.
+ */
+size_t string_size(const void *data) {
+  return strlen((const char *)data) + 1;
+}
 /**
  * Prints a string.
  */
@@ -86,8 +188,16 @@ int compare_strings(const void *data1, const void *data2) {
   return strcmp((const char *)data1, (const char *)data2);
 }
 
-int main(int argc, char** argv)
+int main(int argc, char** raw_argv)
 {
+  ProgramOptions options;
+  char* argv[5];
+  int argc_or_error = parse_options(argc, raw_argv, &options, argv);
+  if (argc_or_error < 0)
+  {
+    return EXIT_FAILURE;
+  }
+  argc = argc_or_error;
   if (argc < 4 || argc > 5)
   {
     printf("%s\n", NUM_ARGS_ERROR);
@@ -111,8 +221,11 @@ int main(int argc, char** argv)
   }
 
   const char* file_path = argv[3];
-  const int total_words_in_file = count_words_in_file(file_path);
-
+  if (options.byte_order > 0)
+  {
+    // Characters, not words: the whole corpus is read
+    return print_byte_tweets(file_path, num_tweets, seed, &options);
+  }
   int max_words_to_read = READ_ALL;
   if (argc == 5)
   {
@@ -122,6 +235,8 @@ int main(int argc, char** argv)
     {
       return EXIT_FAILURE;
     }
+    // Only a word limit needs the count, which reads the corpus once more
+    const int total_words_in_file = count_words_in_file(file_path);
     if (max_words_to_read > total_words_in_file){
       max_words_to_read = total_words_in_file;
     }
@@ -139,20 +254,154 @@ int main(int argc, char** argv)
   markov_chain->copy_func = copy_string;
   markov_chain->is_last = is_terminal_word;
 
-  FILE *file = fopen(file_path, "r");
-  if (!file){
+  CorpusReader corpus;
+  if (corpus_reader_open(&corpus, file_path) != EXIT_SUCCESS){
+    if (argc != 5)
+    {
+      // count_words_in_file() reported the path already
+      printf("%s\n", FILE_PATH_ERROR);
+    }
     printf("Unable to open file.\n");
     free_database(&markov_chain);
     return EXIT_FAILURE;
   }
 
-  if (fill_database(file, max_words_to_read, markov_chain) != EXIT_SUCCESS) {
+  TrainingBudget budget;
+  TrainingBudget *budget_ptr = NULL;
+  if (options.memory_budget > 0) {
+    training_budget_init(&budget, options.memory_budget, string_size);
+    budget_ptr = &budget;
+  }
+
+  int fill_result;
+  if (options.external_budget > 0 &&
+      (options.pipeline || budget_ptr || options.concurrent_readers > 0)) {
+    printf("Error: --external-budget cannot be combined with --pipeline, "
+           "--memory-budget or --concurrent.\n");
+    corpus_reader_close(&corpus);
+    free_database(&markov_chain);
+    return EXIT_FAILURE;
+  }
+  if (options.window_epochs > 0 &&
+      (options.pipeline || budget_ptr || options.concurrent_readers > 0 ||
+       options.external_budget > 0)) {
+    printf("Error: --window cannot be combined with --pipeline, "
+           "--memory-budget, --concurrent or --external-budget.\n");
+    corpus_reader_close(&corpus);
+    free_database(&markov_chain);
+    return EXIT_FAILURE;
+  }
+  double fill_start = stopwatch_now();
+  if (options.window_epochs > 0) {
+    fill_result = fill_database_windowed(&corpus, max_words_to_read,
+                                         markov_chain, &options);
+  } else if (options.external_budget > 0) {
+    ExternalStats external_stats;
+    fill_result = fill_database_external(
+        &corpus, max_words_to_read == READ_ALL ? EXTERNAL_READ_ALL
+                                            : max_words_to_read,
+        markov_chain, hash_string, options.external_budget, &external_stats);
+    if (options.stats) {
+      print_external_stats(stderr, &external_stats);
+    }
+  } else if (options.concurrent_readers > 0) {
+    if (options.pipeline || budget_ptr) {
+      // Snapshots point at live nodes, which pruning would free
+      printf("Error: --concurrent cannot be combined with --pipeline or "
+             "--memory-budget.\n");
+      corpus_reader_close(&corpus);
+      free_database(&markov_chain);
+      return EXIT_FAILURE;
+    }
+    fill_result = fill_database_concurrent(&corpus, max_words_to_read,
+                                           markov_chain,
+                                           options.concurrent_readers, seed);
+  } else if (options.pipeline) {
+    IngestStats ingest_stats;
+    fill_result = fill_database_pipelined(
+        &corpus, max_words_to_read == READ_ALL ? INGEST_READ_ALL
+                                            : max_words_to_read,
+        markov_chain, hash_string, budget_ptr, &ingest_stats);
+    if (options.stats) {
+      print_ingest_stats(stderr, &ingest_stats);
+    }
+  } else {
+    fill_result = fill_database(&corpus, max_words_to_read, markov_chain,
+                                budget_ptr);
+  }
+  double fill_seconds = stopwatch_now() - fill_start;
+  corpus_reader_close(&corpus);
+  if (options.stats) {
+    print_corpus_stats(stderr, &corpus.stats, fill_seconds);
+  }
+  if (budget_ptr && options.stats) {
+    print_budget_stats(stderr, budget_ptr);
+  }
+  if (fill_result == EXIT_SUCCESS && corpus.error) {
+    printf("Error: Failed to decompress the corpus.\n");
+    fill_result = EXIT_FAILURE;
+  }
+  if (fill_result == EXIT_SUCCESS && markov_chain->database->first == NULL) {
+    printf("Error: No words left in the database.\n");
+    fill_result = EXIT_FAILURE;
+  }
+  if (fill_result != EXIT_SUCCESS) {
     printf("Error: Failed to populate database.\n");
-    fclose(file);
     free_database(&markov_chain);
     return EXIT_FAILURE;
   }
 
+  if (options.relayout)
+  {
+    LayoutStats layout_stats;
+    if (optimize_chain_layout(markov_chain, options.layout, &layout_stats)
+        != EXIT_SUCCESS)
+    {
+      printf(ALLOCATION_ERROR_MESSAGE);
+      free_database(&markov_chain);
+      return EXIT_FAILURE;
+    }
+    if (options.stats)
+    {
+      print_layout_stats(stderr, &layout_stats);
+    }
+  }
+
+  if (options.score_path &&
+      score_file(options.score_path, markov_chain, &options) != EXIT_SUCCESS)
+  {
+    free_database(&markov_chain);
+    return EXIT_FAILURE;
+  }
+
+  if (options.analyze_steps >= 0 &&
+      analyze_chain(markov_chain, options.analyze_steps, options.threads)
+          != EXIT_SUCCESS)
+  {
+    free_database(&markov_chain);
+    return EXIT_FAILURE;
+  }
+
+  if (options.beam_width > 0 || options.beam_bench)
+  {
+    int result = options.beam_bench
+                 ? beam_benchmark(markov_chain, num_tweets)
+                 : print_beam_tweets(markov_chain, num_tweets,
+                                     options.beam_width);
+    free_database(&markov_chain);
+    return result;
+  }
+
+  if (options.unique || options.batch_size > 0 || options.start_word)
+  {
+    int result = options.unique
+                 ? print_unique_tweets(markov_chain, num_tweets, seed,
+                                       &options)
+                 : print_batch_tweets(markov_chain, num_tweets, seed,
+                                      &options);
+    free_database(&markov_chain);
+    return result;
+  }
 
   int tweets_generated = 0; // Track successfully generated tweets
 
@@ -164,11 +413,10 @@ int main(int argc, char** argv)
     }
 
     printf("Tweet %d: ", tweets_generated + 1);
-    generate_random_sequence(markov_chain, first_node, 20);
+    generate_random_sequence(markov_chain, first_node, TWEET_MAX_LENGTH);
     tweets_generated++; // Increment only on successful generation
   }
 
-  fclose(file);
   free_database(&markov_chain);
   return EXIT_SUCCESS;
 }
@@ -188,68 +436,1084 @@ bool error_parsing_msg(const char* endptr)
   return true;
 }
 
+/**
+ * Parse a byte count with an optional K, M or G suffix.
+ * @return 0 on success, 1 otherwise
+ */
+int parse_size(const char *str, size_t *size)
+{
+  char *endptr;
+  errno = 0;
+  long long value = strtoll(str, &endptr, BASE_10);
+  size_t unit = 1;
+  if (*endptr == 'K' || *endptr == 'k') unit = 1024;
+  else if (*endptr == 'M' || *endptr == 'm') unit = 1024 * 1024;
+  else if (*endptr == 'G' || *endptr == 'g') unit = 1024 * 1024 * 1024;
+  if (unit != 1)
+  {
+    endptr++;
+  }
+  if (!error_parsing_msg(endptr) || value <= 0)
+  {
+    return 1;
+  }
+  if ((unsigned long long)value > SIZE_MAX / unit)
+  {
+    printf("Error: Size '%s' is too large.\n", str);
+    return 1;
+  }
+  *size = (size_t)value * unit;
+  return 0;
+}
+
+/**
+ * Split argv into "--flag" options and positional arguments.
+ * @param positional receives argv[0] and up to 4 positional arguments
+ * @return number of entries stored in positional, or -1 on an unknown flag
+ */
+int parse_options(int argc, char** argv, ProgramOptions *options,
+                  char** positional)
+{
+  *options = (ProgramOptions) {false, false, 0, NULL, 1, SCORE_SMOOTHING,
+                               0, false, -1, 0, 0, 0, NULL,
+                               UNKNOWN_START_FAIL, 0, WINDOW_EPOCH_LINES,
+                               false, LAYOUT_DFS, false, UNIQUE_MAX_RETRIES, 0};
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 1)
+  {
+    options->threads = (int)cpus;
+  }
+  int count = 0;
+  for (int i = 0; i < argc; i++)
+  {
+    if (i > 0 && strncmp(argv[i], "--", 2) == 0)
+    {
+      if (strcmp(argv[i], "--pipeline") == 0)
+      {
+        options->pipeline = true;
+      }
+      else if (strcmp(argv[i], "--stats") == 0)
+      {
+        options->stats = true;
+      }
+      else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+      {
+        if (parse_size(argv[++i], &options->memory_budget) != 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--external-budget") == 0 && i + 1 < argc)
+      {
+        if (parse_size(argv[++i], &options->external_budget) != 0 ||
+            options->external_budget == 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--score") == 0 && i + 1 < argc)
+      {
+        options->score_path = argv[++i];
+      }
+      else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->threads = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->threads <= 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--beam") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->beam_width = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->beam_width <= 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->analyze_steps = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->analyze_steps < 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--concurrent") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->concurrent_readers = (int)strtol(argv[++i], &endptr,
+                                                  BASE_10);
+        if (!error_parsing_msg(endptr) || options->concurrent_readers <= 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->batch_size = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->batch_size <= 0)
+        {
+          return -1;
+        }
+      }
+      else if ((strcmp(argv[i], "--window") == 0 ||
+                strcmp(argv[i], "--epoch-lines") == 0) && i + 1 < argc)
+      {
+        int *target = strcmp(argv[i], "--window") == 0
+                      ? &options->window_epochs : &options->epoch_lines;
+        char *endptr;
+        errno = 0;
+        *target = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || *target <= 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+      {
+        options->start_word = argv[++i];
+      }
+      else if (strcmp(argv[i], "--unknown-start") == 0 && i + 1 < argc)
+      {
+        i++;
+        if (strcmp(argv[i], "fail") == 0)
+        {
+          options->unknown_start = UNKNOWN_START_FAIL;
+        }
+        else if (strcmp(argv[i], "random") == 0)
+        {
+          options->unknown_start = UNKNOWN_START_RANDOM;
+        }
+        else
+        {
+          printf("Error: --unknown-start must be 'fail' or 'random'.\n");
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc)
+      {
+        if (parse_layout_order(argv[++i], &options->layout) != 0)
+        {
+          printf("Error: --layout must be 'dfs' or 'stationary'.\n");
+          return -1;
+        }
+        options->relayout = true;
+      }
+      else if (strcmp(argv[i], "--unique") == 0)
+      {
+        options->unique = true;
+      }
+      else if (strcmp(argv[i], "--max-retries") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->max_retries = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->max_retries <= 0)
+        {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->byte_order = (int)strtol(argv[++i], &endptr, BASE_10);
+        if (!error_parsing_msg(endptr) || options->byte_order < 1 ||
+            options->byte_order > BYTE_CHAIN_MAX_ORDER)
+        {
+          printf("Error: --bytes must be between 1 and %d.\n",
+                 BYTE_CHAIN_MAX_ORDER);
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--beam-bench") == 0)
+      {
+        options->beam_bench = true;
+      }
+      else if (strcmp(argv[i], "--smoothing") == 0 && i + 1 < argc)
+      {
+        char *endptr;
+        errno = 0;
+        options->smoothing = strtod(argv[++i], &endptr);
+        if (!error_parsing_msg(endptr) || options->smoothing <= 0)
+        {
+          return -1;
+        }
+      }
+      else
+      {
+        printf("Error: Unknown option '%s'.\n", argv[i]);
+        return -1;
+      }
+      continue;
+    }
+    if (count >= 5)
+    {
+      count++; // Too many positional arguments, reported by the caller
+      continue;
+    }
+    positional[count++] = argv[i];
+  }
+  return count;
+}
+
 int count_words_in_file(const char *file_path){
-  FILE *file = fopen(file_path, "r");
-  if (!file){
+  CorpusReader corpus;
+  if (corpus_reader_open(&corpus, file_path) != EXIT_SUCCESS){
     printf("%s\n", FILE_PATH_ERROR);
     return EXIT_FAILURE;
   }
   int word_count = 0;
   char line[LINE_MAX];
 
-  while(fgets(line, LINE_MAX, file)){
+  while(corpus_reader_gets(line, LINE_MAX, &corpus)){
     char* token = strtok(line, DELIMITERS);
     while(token){
       word_count++;
       token = strtok(NULL, DELIMITERS);
     }
   }
-  fclose(file);
+  corpus_reader_close(&corpus);
   return word_count;
 }
 
-int fill_database(FILE *fp, int words_to_read, MarkovChain *markov_chain) {
-  if (fp == NULL || markov_chain == NULL) {
+/**
+ * Train markov_chain on the words of one line, counting them in
+ * words_processed and stopping once words_to_read words were trained on.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int train_line(char *line, int words_to_read, int *words_processed,
+               MarkovChain *markov_chain, TrainingBudget *budget) {
+  Node *prev = NULL;   // Track the previous node
+  // Tokenize the line into words
+  char *token = strtok(line, DELIMITERS);
+  while (token != NULL && (words_to_read == READ_ALL ||
+    *words_processed < words_to_read)) {
+    int old_size = markov_chain->database->size;
+    Node *current_node = add_to_database(markov_chain, token);
+    if (current_node == NULL) {
+      return EXIT_FAILURE; // Handle memory allocation failure
+    }
+    if (markov_chain->database->size != old_size) {
+      training_budget_add_node(budget, current_node->data);
+    }
+
+    if (prev != NULL) {
+      if (add_node_to_freqlist_helper(markov_chain, prev) != 0){
+        if (training_budget_add_edge(budget, prev->data, current_node->data)
+            != EXIT_SUCCESS) {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    // Update `prev` and process the next token
+    prev = current_node;
+    token = strtok(NULL, DELIMITERS);
+    (*words_processed)++;
+  }
+  // Between lines no node is held, so the chain may be pruned here
+  if (training_budget_enforce(budget, markov_chain) != EXIT_SUCCESS) {
+    printf("Error: Memory budget too small for the vocabulary.\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int fill_database(CorpusReader *corpus, int words_to_read,
+                  MarkovChain *markov_chain, TrainingBudget *budget) {
+  if (corpus == NULL || markov_chain == NULL) {
     return EXIT_FAILURE;
   }
 
   char line[LINE_MAX];
-  Node *prev = NULL;   // Track the previous node
   int words_processed = 0;
 
   // Read each line from the file
-  while (fgets(line, LINE_MAX, fp)) {
-    // Tokenize the line into words
+  while (corpus_reader_gets(line, LINE_MAX, corpus)) {
+    if (train_line(line, words_to_read, &words_processed, markov_chain,
+                   budget) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+    // Stop processing if the required number of words is reached
+    if (words_to_read != READ_ALL && words_processed >= words_to_read) {
+      break;
+    }
+  }
+
+  return EXIT_SUCCESS; // Successfully processed the words
+}
+
+/**
+ * Like fill_database(), but only the last --window epochs of
+ * --epoch-lines lines each stay in the chain.
+ */
+int fill_database_windowed(CorpusReader *corpus, int words_to_read,
+                           MarkovChain *markov_chain,
+                           const ProgramOptions *options) {
+  SlidingWindow window;
+  if (sliding_window_init(&window, markov_chain, options->window_epochs,
+                          hash_string) != EXIT_SUCCESS) {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  char line[LINE_MAX];
+  int words_processed = 0;
+  int lines = 0;
+  int result = EXIT_SUCCESS;
+  while (result == EXIT_SUCCESS &&
+         corpus_reader_gets(line, LINE_MAX, corpus)) {
+    MarkovNode *prev = NULL;
     char *token = strtok(line, DELIMITERS);
     while (token != NULL && (words_to_read == READ_ALL ||
-      words_processed < words_to_read)) {
-      Node *current_node = add_to_database(markov_chain, token);
-      if (current_node == NULL) {
-        return EXIT_FAILURE; // Handle memory allocation failure
+                             words_processed < words_to_read)) {
+      prev = sliding_window_add(&window, prev, token);
+      if (!prev) {
+        result = EXIT_FAILURE;
+        break;
       }
+      token = strtok(NULL, DELIMITERS);
+      words_processed++;
+    }
+    if (result == EXIT_SUCCESS && ++lines % options->epoch_lines == 0) {
+      result = sliding_window_advance(&window);
+    }
+    if (words_to_read != READ_ALL && words_processed >= words_to_read) {
+      break;
+    }
+  }
+  sliding_window_finish(&window);
+  if (options->stats) {
+    print_window_stats(stderr, &window.stats);
+  }
+  sliding_window_destroy(&window);
+  return result;
+}
 
-      if (prev != NULL) {
-        if (add_node_to_freqlist_helper(markov_chain, prev) != 0){
-          if (add_node_to_frequency_list(prev->data, current_node->data) != EXIT_SUCCESS) {
-            return EXIT_FAILURE;
-          }
-        }
-      }
+/**
+ * Counters of one reader thread in concurrent mode, on its own cache line.
+ */
+typedef struct ReaderStats {
+  unsigned long long sequences;
+  unsigned long long words;
+  char pad[SNAPSHOT_CACHE_LINE - 2 * sizeof(unsigned long long)];
+} ReaderStats;
 
+typedef struct ConcurrentRun {
+  SnapshotDomain domain;
+  ReaderStats *stats;
+  int stop;
+} ConcurrentRun;
 
-      // Update `prev` and process the next token
-      prev = current_node;
-      token = strtok(NULL, DELIMITERS);
-      words_processed++;
+typedef struct ReaderArg {
+  ConcurrentRun *run;
+  int index;
+  unsigned int seed;
+} ReaderArg;
+
+/**
+ * Reader thread: generate tweets from whatever snapshot is current, until
+ * told to stop. Each batch of tweets is one read section.
+ */
+static void *concurrent_reader(void *arg) {
+  ReaderArg *self = arg;
+  ConcurrentRun *run = self->run;
+  ReaderStats *stats = &run->stats[self->index];
+  MarkovRng rng;
+  markov_rng_seed(&rng, (uint64_t)self->seed * 1000003u + self->index);
+  uint32_t rows[TWEET_MAX_LENGTH];
+  while (!__atomic_load_n(&run->stop, __ATOMIC_ACQUIRE)) {
+    const ChainSnapshot *snapshot = snapshot_acquire(&run->domain,
+                                                     self->index);
+    unsigned long long words = 0, sequences = 0;
+    for (int i = 0; i < CONCURRENT_BATCH; i++) {
+      int length = snapshot_generate(snapshot, &rng, rows, TWEET_MAX_LENGTH);
+      words += (unsigned long long)length;
+      sequences += length > 0;
+    }
+    snapshot_release(&run->domain, self->index);
+    __atomic_store_n(&stats->sequences, stats->sequences + sequences,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->words, stats->words + words, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+static void sum_reader_stats(const ConcurrentRun *run, int num_readers,
+                             unsigned long long *sequences,
+                             unsigned long long *words) {
+  *sequences = 0;
+  *words = 0;
+  for (int i = 0; i < num_readers; i++) {
+    *sequences += __atomic_load_n(&run->stats[i].sequences, __ATOMIC_RELAXED);
+    *words += __atomic_load_n(&run->stats[i].words, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Train like fill_database() while num_readers threads keep generating from
+ * published snapshots, then report generation throughput with and without
+ * the concurrent writer. A snapshot copies the whole chain, so the gap
+ * between publications grows with the lines trained (at least
+ * CONCURRENT_PUBLISH_LINES, at most a 1 / CONCURRENT_PUBLISH_GROWTH
+ * increase): the copies then cost a constant factor of training instead
+ * of growing with the square of the corpus.
+ */
+int fill_database_concurrent(CorpusReader *corpus, int words_to_read,
+                             MarkovChain *markov_chain, int num_readers,
+                             unsigned int seed) {
+  ConcurrentRun run;
+  run.stop = 0;
+  run.stats = calloc((size_t)num_readers, sizeof(ReaderStats));
+  pthread_t *threads = malloc((size_t)num_readers * sizeof(pthread_t));
+  ReaderArg *args = malloc((size_t)num_readers * sizeof(ReaderArg));
+  if (!run.stats || !threads || !args ||
+      snapshot_domain_init(&run.domain, num_readers) != 0) {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    free(run.stats);
+    free(threads);
+    free(args);
+    return EXIT_FAILURE;
+  }
+
+  int result = snapshot_publish(&run.domain, markov_chain) == 0
+               ? EXIT_SUCCESS : EXIT_FAILURE;
+  int started = 0;
+  for (int i = 0; result == EXIT_SUCCESS && i < num_readers; i++) {
+    args[i] = (ReaderArg) {&run, i, seed};
+    if (pthread_create(&threads[i], NULL, concurrent_reader, &args[i]) != 0) {
+      result = EXIT_FAILURE;
+      break;
+    }
+    started++;
+  }
+
+  double start = stopwatch_now();
+  char line[LINE_MAX];
+  int words_processed = 0, lines = 0;
+  int next_publish = CONCURRENT_PUBLISH_LINES;
+  while (result == EXIT_SUCCESS &&
+         corpus_reader_gets(line, LINE_MAX, corpus)) {
+    result = train_line(line, words_to_read, &words_processed,
+                        markov_chain, NULL);
+    if (result == EXIT_SUCCESS && ++lines >= next_publish) {
+      result = snapshot_publish(&run.domain, markov_chain) == 0
+               ? EXIT_SUCCESS : EXIT_FAILURE;
+      int gap = lines / CONCURRENT_PUBLISH_GROWTH;
+      next_publish = lines + (gap > CONCURRENT_PUBLISH_LINES
+                              ? gap : CONCURRENT_PUBLISH_LINES);
     }
-    prev = NULL;
-    // Stop processing if the required number of words is reached
     if (words_to_read != READ_ALL && words_processed >= words_to_read) {
       break;
     }
   }
+  if (result == EXIT_SUCCESS &&
+      snapshot_publish(&run.domain, markov_chain) != 0) {
+    result = EXIT_FAILURE;
+  }
+  double write_seconds = stopwatch_now() - start;
+  unsigned long long loaded_seqs, loaded_words;
+  sum_reader_stats(&run, num_readers, &loaded_seqs, &loaded_words);
 
-  return EXIT_SUCCESS; // Successfully processed the words
+  // Same readers on a quiet chain, for comparison
+  double idle_seconds = write_seconds < CONCURRENT_MAX_IDLE_SECONDS
+                        ? write_seconds : CONCURRENT_MAX_IDLE_SECONDS;
+  double idle_start = stopwatch_now();
+  while (result == EXIT_SUCCESS && started > 0 &&
+         stopwatch_now() - idle_start < idle_seconds) {
+    sched_yield();
+  }
+  idle_seconds = stopwatch_now() - idle_start;
+  unsigned long long total_seqs, total_words;
+  sum_reader_stats(&run, num_readers, &total_seqs, &total_words);
+
+  __atomic_store_n(&run.stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  if (result == EXIT_SUCCESS) {
+    fprintf(stderr, "Concurrent training: %d lines in %.3f s, "
+                    "%zu snapshots published, %zu reclaimed\n",
+            lines, write_seconds, run.domain.published,
+            run.domain.reclaimed);
+    fprintf(stderr, "  snapshots built in %.3f s (%.1f%% of training), "
+                    "%llu rows and %llu transitions copied\n",
+            run.domain.build_seconds,
+            write_seconds > 0 ? 100.0 * run.domain.build_seconds /
+                                write_seconds : 0.0,
+            run.domain.rows_copied, run.domain.edges_copied);
+    fprintf(stderr, "  %d readers under write load: %.0f tweets/s, "
+                    "%.0f words/s\n", num_readers,
+            write_seconds > 0 ? (double)loaded_seqs / write_seconds : 0.0,
+            write_seconds > 0 ? (double)loaded_words / write_seconds : 0.0);
+    fprintf(stderr, "  %d readers without writes: %.0f tweets/s, "
+                    "%.0f words/s\n", num_readers,
+            idle_seconds > 0 ? (double)(total_seqs - loaded_seqs) /
+                               idle_seconds : 0.0,
+            idle_seconds > 0 ? (double)(total_words - loaded_words) /
+                               idle_seconds : 0.0);
+  }
+  snapshot_domain_destroy(&run.domain);
+  free(run.stats);
+  free(threads);
+  free(args);
+  return result;
+}
+
+/**
+ * Append len bytes of src to the growable buffer *buf.
+ * @return 0 on success, 1 on allocation failure
+ */
+int append_bytes(void **buf, size_t *used, size_t *capacity,
+                 const void *src, size_t len)
+{
+  if (*used + len > *capacity)
+  {
+    size_t new_capacity = *capacity ? *capacity * 2 : 4096;
+    while (new_capacity < *used + len)
+    {
+      new_capacity *= 2;
+    }
+    void *grown = realloc(*buf, new_capacity);
+    if (!grown)
+    {
+      printf(ALLOCATION_ERROR_MESSAGE);
+      return 1;
+    }
+    *buf = grown;
+    *capacity = new_capacity;
+  }
+  memcpy((char *)*buf + *used, src, len);
+  *used += len;
+  return 0;
+}
+
+/**
+ * Score every line of path as one word sequence and print its
+ * log-probability and perplexity, followed by the scoring throughput.
+ */
+int score_file(const char *path, MarkovChain *markov_chain,
+               const ProgramOptions *options)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+  {
+    printf("%s\n", FILE_PATH_ERROR);
+    return EXIT_FAILURE;
+  }
+  // Words are packed into text; words and offsets hold byte and word
+  // offsets until the text buffer stops moving
+  void *text = NULL, *words = NULL, *offsets = NULL;
+  size_t text_used = 0, text_cap = 0;
+  size_t words_used = 0, words_cap = 0;
+  size_t offsets_used = 0, offsets_cap = 0;
+  size_t zero = 0;
+  int failed = append_bytes(&offsets, &offsets_used, &offsets_cap,
+                            &zero, sizeof(size_t));
+  char line[LINE_MAX];
+  while (!failed && fgets(line, LINE_MAX, fp))
+  {
+    size_t before = words_used;
+    for (char *token = strtok(line, DELIMITERS); token && !failed;
+         token = strtok(NULL, DELIMITERS))
+    {
+      size_t at = text_used;
+      failed = append_bytes(&words, &words_used, &words_cap,
+                            &at, sizeof(size_t)) ||
+               append_bytes(&text, &text_used, &text_cap,
+                            token, strlen(token) + 1);
+    }
+    if (!failed && words_used != before)
+    {
+      size_t end = words_used / sizeof(size_t);
+      failed = append_bytes(&offsets, &offsets_used, &offsets_cap,
+                            &end, sizeof(size_t));
+    }
+  }
+  fclose(fp);
+
+  ScoreBatch batch;
+  batch.count = offsets_used / sizeof(size_t) - 1;
+  batch.offsets = offsets;
+  size_t num_words = words_used / sizeof(size_t);
+  const void **tokens = NULL;
+  SequenceScore *results = NULL;
+  ScoreModel model;
+  bool model_built = false;
+  if (!failed)
+  {
+    tokens = malloc((num_words ? num_words : 1) * sizeof(void *));
+    results = malloc((batch.count ? batch.count : 1) *
+                     sizeof(SequenceScore));
+    model_built = tokens && results &&
+                  score_model_build(&model, markov_chain, hash_string,
+                                    options->smoothing) == 0;
+    failed = !model_built;
+  }
+  if (!failed)
+  {
+    for (size_t i = 0; i < num_words; i++)
+    {
+      tokens[i] = (char *)text + ((size_t *)words)[i];
+    }
+    batch.tokens = tokens;
+    double start = stopwatch_now();
+    failed = score_sequences(&model, &batch, results, options->threads);
+    double elapsed = stopwatch_now() - start;
+    for (size_t i = 0; !failed && i < batch.count; i++)
+    {
+      printf("Sequence %zu: log-prob %.4f, perplexity %.4f\n", i + 1,
+             results[i].log_prob, results[i].perplexity);
+    }
+    if (!failed)
+    {
+      printf("Scored %zu sequences (%zu words) with %d threads in %.3f s: "
+             "%.0f words/s\n", batch.count, num_words, options->threads,
+             elapsed, elapsed > 0 ? (double)num_words / elapsed : 0.0);
+    }
+  }
+  if (failed)
+  {
+    printf("Error: Failed to score %s.\n", path);
+  }
+  if (model_built)
+  {
+    score_model_free(&model);
+  }
+  free(results);
+  free(tokens);
+  free(text);
+  free(words);
+  free(offsets);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * For num_tweets random start words, print the beam_width most likely
+ * tweets with their log-probabilities.
+ */
+int print_beam_tweets(MarkovChain *markov_chain, int num_tweets,
+                      int beam_width)
+{
+  BeamDecoder decoder;
+  if (beam_decoder_init(&decoder, beam_width, TWEET_MAX_LENGTH) != 0)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  sort_frequency_lists(markov_chain);
+  MarkovNode *path[TWEET_MAX_LENGTH];
+  for (int tweet = 0; tweet < num_tweets; tweet++)
+  {
+    int found = beam_decode(&decoder, markov_chain,
+                            get_first_random_node(markov_chain));
+    for (int rank = 0; rank < found; rank++)
+    {
+      double log_prob;
+      int length = beam_decoder_result(&decoder, rank, path, &log_prob);
+      printf("Tweet %d.%d (log-prob %.3f): ", tweet + 1, rank + 1, log_prob);
+      for (int i = 0; i < length; i++)
+      {
+        markov_chain->print_func(path[i]->data);
+      }
+      printf("\n");
+    }
+  }
+  beam_decoder_free(&decoder);
+  return EXIT_SUCCESS;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/**
+ * Decode num_requests random start words with beam widths 1, 2, 4 .. 64
+ * and print the per-request latency of each width.
+ */
+int beam_benchmark(MarkovChain *markov_chain, int num_requests)
+{
+  if (num_requests <= 0)
+  {
+    return EXIT_SUCCESS;
+  }
+  MarkovNode **starts = malloc((size_t)num_requests * sizeof(MarkovNode *));
+  double *latencies = malloc((size_t)num_requests * sizeof(double));
+  if (!starts || !latencies)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    free(starts);
+    free(latencies);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < num_requests; i++)
+  {
+    starts[i] = get_first_random_node(markov_chain);
+  }
+  sort_frequency_lists(markov_chain);
+
+  printf("width   mean (us)    p50 (us)    p99 (us)\n");
+  int result = EXIT_SUCCESS;
+  for (int width = 1; width <= BEAM_BENCH_MAX_WIDTH; width *= 2)
+  {
+    BeamDecoder decoder;
+    if (beam_decoder_init(&decoder, width, TWEET_MAX_LENGTH) != 0)
+    {
+      printf(ALLOCATION_ERROR_MESSAGE);
+      result = EXIT_FAILURE;
+      break;
+    }
+    double total = 0;
+    for (int i = 0; i < num_requests; i++)
+    {
+      double start = stopwatch_now();
+      beam_decode(&decoder, markov_chain, starts[i]);
+      latencies[i] = (stopwatch_now() - start) * 1e6;
+      total += latencies[i];
+    }
+    beam_decoder_free(&decoder);
+    qsort(latencies, (size_t)num_requests, sizeof(double), compare_doubles);
+    printf("%5d %11.2f %11.2f %11.2f\n", width, total / num_requests,
+           latencies[num_requests / 2],
+           latencies[(size_t)num_requests * 99 / 100]);
+  }
+  free(starts);
+  free(latencies);
+  return result;
+}
+
+/**
+ * Print the most central words (highest stationary probability) and the
+ * probability that a tweet starting at each of them ends within k steps.
+ */
+int analyze_chain(MarkovChain *markov_chain, int k, int num_threads)
+{
+  TransitionMatrix matrix;
+  if (transition_matrix_build(&matrix, markov_chain) != 0)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  double *stationary = malloc(matrix.rows * sizeof(double));
+  double *reach = malloc(matrix.rows * sizeof(double));
+  MarkovNode **nodes = malloc(matrix.rows * sizeof(MarkovNode *));
+  AnalysisReport st_report, reach_report;
+  int failed = !stationary || !reach || !nodes ||
+               stationary_distribution(&matrix, ANALYSIS_DAMPING,
+                                       ANALYSIS_TOLERANCE,
+                                       ANALYSIS_MAX_ITERATIONS, num_threads,
+                                       stationary, &st_report) != 0 ||
+               terminal_reachability(&matrix, k, num_threads, reach,
+                                     &reach_report) != 0;
+  if (!failed)
+  {
+    for (Node *cur = markov_chain->database->first; cur; cur = cur->next)
+    {
+      nodes[((MarkovNode *)cur->data)->id] = cur->data;
+    }
+    printf("Transition matrix: %zu words, %zu transitions\n", matrix.rows,
+           matrix.edges);
+    printf("Stationary distribution: %s after %d iterations "
+           "(residual %.3g, %.3f s)\n",
+           st_report.converged ? "converged" : "not converged",
+           st_report.iterations, st_report.residual, st_report.seconds);
+    printf("Reachability within %d steps: %.3f s\n", k,
+           reach_report.seconds);
+    // Insertion into a short sorted list of the best words so far
+    size_t top[ANALYSIS_TOP_WORDS];
+    size_t num_top = 0;
+    for (size_t i = 0; i < matrix.rows; i++)
+    {
+      if (num_top == ANALYSIS_TOP_WORDS &&
+          stationary[i] <= stationary[top[num_top - 1]])
+      {
+        continue;
+      }
+      size_t at = num_top < ANALYSIS_TOP_WORDS ? num_top++ : num_top - 1;
+      while (at > 0 && stationary[top[at - 1]] < stationary[i])
+      {
+        top[at] = top[at - 1];
+        at--;
+      }
+      top[at] = i;
+    }
+    for (size_t i = 0; i < num_top; i++)
+    {
+      printf("%2zu. p=%.5f, ends within %d: %.3f  ", i + 1,
+             stationary[top[i]], k, reach[top[i]]);
+      markov_chain->print_func(nodes[top[i]]->data);
+      printf("\n");
+    }
+  }
+  else
+  {
+    printf("Error: Failed to analyze the chain.\n");
+  }
+  free(stationary);
+  free(reach);
+  free(nodes);
+  transition_matrix_free(&matrix);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Generate the tweets --batch at a time into flat token buffers, from
+ * --start if given, then print them. With --stats, the generation
+ * throughput and latency per batch (printing excluded) are reported on
+ * stderr.
+ */
+int print_batch_tweets(MarkovChain *markov_chain, int num_tweets,
+                       unsigned int seed, const ProgramOptions *options)
+{
+  GenerationTable table;
+  if (generation_table_build(&table, markov_chain,
+                             options->start_word ? hash_string : NULL) != 0)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  if (options->start_word && options->unknown_start == UNKNOWN_START_FAIL &&
+      generation_table_lookup(&table, options->start_word) < 0)
+  {
+    printf("Error: Unknown start word '%s'.\n", options->start_word);
+    generation_table_free(&table);
+    return EXIT_FAILURE;
+  }
+  int batch_size = options->batch_size > 0 ? options->batch_size
+                                           : PROMPT_BATCH;
+  SequenceBatch batch;
+  batch.max_sequences = (size_t)batch_size;
+  batch.token_capacity = (size_t)batch_size * TWEET_MAX_LENGTH;
+  batch.tokens = malloc(batch.token_capacity * sizeof(uint32_t));
+  batch.offsets = malloc(batch.max_sequences * sizeof(size_t));
+  batch.lengths = malloc(batch.max_sequences * sizeof(uint32_t));
+  if (!batch.tokens || !batch.offsets || !batch.lengths)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    free(batch.tokens);
+    free(batch.offsets);
+    free(batch.lengths);
+    generation_table_free(&table);
+    return EXIT_FAILURE;
+  }
+
+  MarkovRng rng;
+  markov_rng_seed(&rng, seed);
+  double generate_seconds = 0;
+  unsigned long long words = 0;
+  int tweets_generated = 0;
+  int batches = 0;
+  while (tweets_generated < num_tweets)
+  {
+    size_t wanted = (size_t)(num_tweets - tweets_generated);
+    double start = stopwatch_now();
+    size_t count = options->start_word
+                   ? generate_batch_from(&table, options->start_word,
+                                         options->unknown_start, &rng, wanted,
+                                         TWEET_MAX_LENGTH, &batch)
+                   : generate_batch(&table, &rng, wanted, TWEET_MAX_LENGTH,
+                                    &batch);
+    generate_seconds += stopwatch_now() - start;
+    batches++;
+    if (count == 0)
+    {
+      break; // No start word
+    }
+    words += batch.used;
+    for (size_t i = 0; i < count; i++)
+    {
+      printf("Tweet %d: ", ++tweets_generated);
+      render_sequence(&table, markov_chain, batch.tokens + batch.offsets[i],
+                      batch.lengths[i]);
+    }
+  }
+  if (options->stats && generate_seconds > 0)
+  {
+    fprintf(stderr, "Batch generation: %d tweets, %llu words in %.3f s "
+            "(%.0f tweets/s, %.0f words/s, %.2f us per batch of %d)\n",
+            tweets_generated, words, generate_seconds,
+            tweets_generated / generate_seconds, words / generate_seconds,
+            generate_seconds * 1e6 / batches, batch_size);
+  }
+  free(batch.tokens);
+  free(batch.offsets);
+  free(batch.lengths);
+  generation_table_free(&table);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Generate num_tweets distinct tweets with --threads threads, from --start
+ * if given, then print them. Fewer are printed, with a warning on stderr,
+ * if --max-retries duplicates come in a row. With --stats, the uniqueness
+ * rate (distinct tweets per tweet walked) is reported on stderr.
+ */
+int print_unique_tweets(MarkovChain *markov_chain, int num_tweets,
+                        unsigned int seed, const ProgramOptions *options)
+{
+  if (num_tweets <= 0)
+  {
+    return EXIT_SUCCESS; // nothing to print, like the sequential loop
+  }
+  size_t wanted = (size_t)num_tweets;
+  GenerationTable table;
+  if (generation_table_build(&table, markov_chain,
+                             options->start_word ? hash_string : NULL) != 0)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  if (options->start_word && options->unknown_start == UNKNOWN_START_FAIL &&
+      generation_table_lookup(&table, options->start_word) < 0)
+  {
+    printf("Error: Unknown start word '%s'.\n", options->start_word);
+    generation_table_free(&table);
+    return EXIT_FAILURE;
+  }
+  SequenceBatch batch;
+  batch.max_sequences = wanted;
+  batch.token_capacity = wanted * TWEET_MAX_LENGTH;
+  batch.tokens = malloc(batch.token_capacity * sizeof(uint32_t));
+  batch.offsets = malloc(batch.max_sequences * sizeof(size_t));
+  batch.lengths = malloc(batch.max_sequences * sizeof(uint32_t));
+  if (!batch.tokens || !batch.offsets || !batch.lengths)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    free(batch.tokens);
+    free(batch.offsets);
+    free(batch.lengths);
+    generation_table_free(&table);
+    return EXIT_FAILURE;
+  }
+
+  UniqueStats stats;
+  size_t count = generate_batch_unique(&table, options->start_word,
+                                       options->unknown_start, seed,
+                                       wanted, TWEET_MAX_LENGTH,
+                                       options->max_retries, options->threads,
+                                       &batch, &stats);
+  for (size_t i = 0; i < count; i++)
+  {
+    printf("Tweet %zu: ", i + 1);
+    render_sequence(&table, markov_chain, batch.tokens + batch.offsets[i],
+                    batch.lengths[i]);
+  }
+  if (stats.exhausted && count < wanted)
+  {
+    fprintf(stderr, "Only %zu of %d tweets are distinct: gave up after %d "
+            "duplicates in a row.\n", count, num_tweets,
+            options->max_retries);
+  }
+  if (options->stats)
+  {
+    fprintf(stderr, "Unique generation: %zu of %zu tweets from %llu walks, "
+            "%llu duplicates rejected (uniqueness rate %.1f%%), "
+            "%d threads, %.3f s\n", stats.generated, stats.requested,
+            stats.attempts, stats.duplicates,
+            stats.attempts ? 100.0 * stats.generated / stats.attempts : 0.0,
+            stats.threads, stats.seconds);
+  }
+  free(batch.tokens);
+  free(batch.offsets);
+  free(batch.lengths);
+  generation_table_free(&table);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Train an order --bytes chain over the characters of the corpus, one line
+ * per tweet, and print num_tweets tweets of up to TWEET_MAX_BYTES
+ * characters. With --stats, training and generation throughput are
+ * reported on stderr.
+ */
+int print_byte_tweets(const char *file_path, int num_tweets,
+                      unsigned int seed, const ProgramOptions *options)
+{
+  ByteChain chain;
+  if (byte_chain_init(&chain, options->byte_order) != EXIT_SUCCESS)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  CorpusReader corpus;
+  if (corpus_reader_open(&corpus, file_path) != EXIT_SUCCESS)
+  {
+    printf("%s\n", FILE_PATH_ERROR);
+    printf("Unable to open file.\n");
+    byte_chain_destroy(&chain);
+    return EXIT_FAILURE;
+  }
+  double fill_start = stopwatch_now();
+  int result = EXIT_SUCCESS;
+  char line[LINE_MAX];
+  while (result == EXIT_SUCCESS &&
+         corpus_reader_gets(line, LINE_MAX, &corpus))
+  {
+    result = byte_chain_train(&chain, (const unsigned char *) line,
+                              strlen(line));
+  }
+  double fill_seconds = stopwatch_now() - fill_start;
+  corpus_reader_close(&corpus);
+  if (options->stats)
+  {
+    print_corpus_stats(stderr, &corpus.stats, fill_seconds);
+  }
+  if (result != EXIT_SUCCESS)
+  {
+    printf(ALLOCATION_ERROR_MESSAGE);
+  }
+  else if (corpus.error)
+  {
+    printf("Error: Failed to decompress the corpus.\n");
+    result = EXIT_FAILURE;
+  }
+  else if (byte_chain_finalize(&chain) != EXIT_SUCCESS)
+  {
+    printf("Error: No lines to learn from in the corpus.\n");
+    result = EXIT_FAILURE;
+  }
+  if (result != EXIT_SUCCESS)
+  {
+    byte_chain_destroy(&chain);
+    return EXIT_FAILURE;
+  }
+
+  MarkovRng rng;
+  markov_rng_seed(&rng, seed);
+  unsigned char tweet[TWEET_MAX_BYTES];
+  double generated = 0;
+  double generate_seconds = 0;
+  for (int i = 0; i < num_tweets; i++)
+  {
+    uint32_t context = chain.start_context;
+    double start = stopwatch_now();
+    size_t length = byte_chain_generate(&chain, &rng, &context, tweet,
+                                        TWEET_MAX_BYTES, true);
+    generate_seconds += stopwatch_now() - start;
+    generated += length;
+    bool ended = length > 0 && tweet[length - 1] == BYTE_CHAIN_DELIMITER;
+    printf("Tweet %d: %.*s%s\n", i + 1, (int) (ended ? length - 1 : length),
+           (const char *) tweet, ended ? "" : " ->");
+  }
+  if (options->stats)
+  {
+    print_byte_chain_stats(stderr, &chain.stats, generated, generate_seconds);
+  }
+  byte_chain_destroy(&chain);
+  return EXIT_SUCCESS;
 }
 
 MarkovChain* initialize_markov_chain() {
@@ -268,6 +1532,7 @@ MarkovChain* initialize_markov_chain() {
   }
   markov_chain->database->first = NULL;
   markov_chain->database->last = NULL;
+  markov_chain->database->size = 0;
 
   return markov_chain;
 }